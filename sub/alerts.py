@@ -0,0 +1,503 @@
+import json
+import logging
+import operator
+import queue
+import sqlite3
+import threading
+import time
+import urllib.request
+from bisect import bisect_left, bisect_right
+from typing import Any, Dict, List, Optional, Tuple
+
+from derived import DERIVED_FIELDS
+from quality import QUALITY_FIELDS, field_flagged, is_number
+
+# ----------------------------
+# Alert rules evaluated on the ingest stream
+# ----------------------------
+#
+# Rules are read from a JSON file (ALERT_RULES) holding a list of objects:
+#
+#   {"name": "hot", "type": "threshold", "field": "bmp280_temperature_c",
+#    "op": ">", "value": 35}
+#   {"name": "pressure-falling", "type": "rate", "field": "bmp280_pressure_pa",
+#    "window": 10800, "op": "<=", "value": -300}
+#   {"name": "silent", "type": "silent", "after": 600}
+#   {"name": "weak-wifi", "type": "degradation", "field": "rssi",
+#    "window": 600, "baseline": 86400, "drop": 10}
+#
+# threshold    the reading compared with `value`
+# rate         change since the oldest reading of the last `window` seconds
+# silent       no message from the device for `after` seconds
+# degradation  mean over the last `window` seconds below the mean over the
+#              last `baseline` seconds by more than `drop`
+#
+# Every rule may also set "devices" (a list of device ids, default all) and
+# "hold_down" (seconds, default DEFAULT_HOLD_DOWN).
+#
+# Fields are the measured ones (quality.py) and those derived at ingest
+# (derived.py), e.g. a pressure_tendency_pa_3h threshold for a falling
+# barometer.
+#
+# Each stored reading is checked against the rules of the fields it carries,
+# using per-device sliding windows kept in memory, so evaluation never
+# queries the database. Flagged values (see quality.py) are skipped. Silent
+# rules are checked every ALERT_CHECK_INTERVAL seconds instead.
+#
+# An alert fires once when its condition becomes true and resolves when it
+# turns false. After firing, the same rule and device stay quiet for
+# `hold_down` seconds even if the condition clears and returns, so a value
+# hovering at a threshold does not flood the sink.
+
+RULE_FIELDS = QUALITY_FIELDS + DERIVED_FIELDS
+
+DEFAULT_HOLD_DOWN = 1800
+SINK_QUEUE_SIZE = 1000
+WEBHOOK_TIMEOUT = 5
+
+OPERATORS = {
+    ">": operator.gt,
+    ">=": operator.ge,
+    "<": operator.lt,
+    "<=": operator.le,
+}
+
+REQUIRED = {
+    "threshold": ("field", "op", "value"),
+    "rate": ("field", "window", "op", "value"),
+    "silent": ("after",),
+    "degradation": ("window", "baseline", "drop"),
+}
+
+
+class Rule:
+    def __init__(self, spec: Dict[str, Any]):
+        self.name = spec.get("name")
+        self.type = spec.get("type")
+        if not self.name or self.type not in REQUIRED:
+            raise ValueError(f"Rule {spec!r}: needs a name and a type of {', '.join(REQUIRED)}")
+        missing = [key for key in REQUIRED[self.type] if key not in spec]
+        if missing:
+            raise ValueError(f"Rule {self.name}: missing {', '.join(missing)}")
+
+        self.field = spec.get("field", "rssi" if self.type == "degradation" else None)
+        if self.field is not None and self.field not in RULE_FIELDS:
+            raise ValueError(f"Rule {self.name}: field must be one of {', '.join(RULE_FIELDS)}")
+        self.op = spec.get("op")
+        if self.op is not None and self.op not in OPERATORS:
+            raise ValueError(f"Rule {self.name}: op must be one of {' '.join(OPERATORS)}")
+        self.compare = OPERATORS.get(self.op)
+        self.value = spec.get("value")
+        self.window = spec.get("window")
+        self.baseline = spec.get("baseline")
+        self.drop = spec.get("drop")
+        self.after = spec.get("after")
+        self.hold_down = spec.get("hold_down", DEFAULT_HOLD_DOWN)
+        devices = spec.get("devices")
+        self.devices = set(devices) if devices is not None else None
+
+        if self.type == "degradation" and self.baseline <= self.window:
+            raise ValueError(f"Rule {self.name}: baseline must be longer than window")
+
+        # Every value rule compares one observed quantity with a limit. Rules
+        # observing the same quantity share its computation and are kept
+        # sorted by limit (see AlertEngine).
+        if self.type == "threshold":
+            self.key: Tuple = ("value", self.field)
+            self.limit = self.value
+        elif self.type == "rate":
+            self.key = ("change", self.field, self.window)
+            self.limit = self.value
+        elif self.type == "degradation":
+            self.key = ("shift", self.field, self.window, self.baseline)
+            self.compare = operator.lt
+            self.limit = -self.drop
+
+    @property
+    def span(self) -> Optional[float]:
+        """Seconds of history the rule needs per device, None for the latest value only."""
+        if self.type == "rate":
+            return self.window
+        if self.type == "degradation":
+            return self.baseline
+        return None
+
+    def describe(self) -> Dict[str, Any]:
+        keys = ("field", "op", "value", "window", "baseline", "drop", "after")
+        return {key: getattr(self, key) for key in keys if getattr(self, key) is not None}
+
+
+def load_rules(path: str) -> List[Rule]:
+    with open(path) as f:
+        rules = [Rule(spec) for spec in json.load(f)]
+    names = [rule.name for rule in rules]
+    duplicates = {name for name in names if names.count(name) > 1}
+    if duplicates:
+        raise ValueError(f"Duplicate rule names: {', '.join(sorted(duplicates))}")
+    return rules
+
+
+class Window:
+    """
+    One field of one device over the last `span` seconds, in arrival order.
+    Prefix sums give the mean of any suffix in O(log n).
+    """
+
+    __slots__ = ("span", "times", "values", "sums", "start")
+
+    def __init__(self, span: float):
+        self.span = span
+        self.times: List[int] = []
+        self.values: List[float] = []
+        self.sums: List[float] = [0.0]
+        self.start = 0
+
+    def add(self, ts: int, value: float) -> None:
+        self.times.append(ts)
+        self.values.append(value)
+        self.sums.append(self.sums[-1] + value)
+        self.start = bisect_left(self.times, ts - self.span, self.start)
+        if self.start > 64 and self.start * 2 > len(self.times):
+            # Drop expired samples in one go; rebasing keeps the sums small.
+            base = self.sums[self.start]
+            self.times = self.times[self.start :]
+            self.values = self.values[self.start :]
+            self.sums = [s - base for s in self.sums[self.start :]]
+            self.start = 0
+
+    def oldest(self) -> int:
+        return self.times[self.start]
+
+    def first_since(self, since: float) -> float:
+        return self.values[bisect_left(self.times, since, self.start)]
+
+    def mean_since(self, since: float) -> float:
+        i = bisect_left(self.times, since, self.start)
+        return (self.sums[-1] - self.sums[i]) / (len(self.times) - i)
+
+
+def observe(key: Tuple, value: float, window: Optional[Window], now: int) -> Optional[float]:
+    """The quantity a rule key compares, None while there is too little history."""
+    kind = key[0]
+    if kind == "value":
+        return value
+    if kind == "change":
+        return value - window.first_since(now - key[2])
+    # shift: mean of the short window minus the baseline mean, once the
+    # baseline reaches back past the short window.
+    _, _, short, baseline = key
+    if window.oldest() > now - short:
+        return None
+    return window.mean_since(now - short) - window.mean_since(now - baseline)
+
+
+class RuleGroup:
+    """Rules observing the same quantity, sorted by limit."""
+
+    __slots__ = ("key", "limits", "rules")
+
+    def __init__(self, key: Tuple, rules: List[Rule]):
+        self.key = key
+        self.rules = sorted(rules, key=lambda rule: rule.limit)
+        self.limits = [rule.limit for rule in self.rules]
+
+
+class AlertState:
+    __slots__ = ("firing", "held", "quiet_until")
+
+    def __init__(self):
+        self.firing = False
+        # Condition true, but the hold-down keeps the alert from firing again.
+        self.held = False
+        self.quiet_until = float("-inf")
+
+
+class AlertEngine:
+    """
+    Evaluates rules against readings in ingest order.
+
+    Evaluation is incremental: a rule's outcome only changes when its
+    observed quantity crosses its limit, so per reading and quantity only
+    the rules with a limit between the previous and the current value are
+    checked, found by bisection, plus any that are waiting out a hold-down.
+    The cost per message grows with the number of distinct quantities and
+    of state changes, not with the number of rules.
+
+    evaluate() runs on the ingest thread and check_silent() on a timer
+    thread; they share only the last-seen times, and state changes, which
+    are rare, take a lock.
+    """
+
+    def __init__(self, rules: List[Rule], sink: Optional["AlertSink"] = None):
+        self.rules = rules
+        self.sink = sink
+        self.value_rules = [rule for rule in rules if rule.type != "silent"]
+        self.silent_rules = [rule for rule in rules if rule.type == "silent"]
+        self.spans: Dict[str, float] = {}
+        for rule in self.value_rules:
+            if rule.span:
+                self.spans[rule.field] = max(self.spans.get(rule.field, 0), rule.span)
+
+        # Per device: [(field, [RuleGroup])] of the rules that apply to it,
+        # shared between devices with the same set of rules.
+        self.plans: Dict[str, List[Tuple[str, List[RuleGroup]]]] = {}
+        self._plans_by_rules: Dict[Tuple[int, ...], List[Tuple[str, List[RuleGroup]]]] = {}
+
+        self.windows: Dict[Tuple[str, str], Window] = {}
+        self.observed: Dict[Tuple[str, Tuple], float] = {}
+        # Rules held by the hold-down, rechecked once the earliest expires.
+        self.pending: Dict[Tuple[str, Tuple], List[Rule]] = {}
+        self.pending_due: Dict[Tuple[str, Tuple], float] = {}
+        self.last_seen: Dict[str, int] = {}
+        self.states: Dict[Tuple[str, str], AlertState] = {}
+        self.lock = threading.Lock()
+        # Set while replaying history, so alerts already sent are not sent again.
+        self.muted = False
+
+        self.fired = 0
+        self.resolved = 0
+        self.suppressed = 0
+
+    def plan(self, device_id: str) -> List[Tuple[str, List[RuleGroup]]]:
+        applicable = tuple(
+            i
+            for i, rule in enumerate(self.value_rules)
+            if rule.devices is None or device_id in rule.devices
+        )
+        plan = self._plans_by_rules.get(applicable)
+        if plan is None:
+            by_key: Dict[Tuple, List[Rule]] = {}
+            for i in applicable:
+                rule = self.value_rules[i]
+                by_key.setdefault(rule.key, []).append(rule)
+            by_field: Dict[str, List[RuleGroup]] = {}
+            for key, group in by_key.items():
+                by_field.setdefault(key[1], []).append(RuleGroup(key, group))
+            plan = self._plans_by_rules[applicable] = list(by_field.items())
+        self.plans[device_id] = plan
+        return plan
+
+    def evaluate(self, reading: Dict[str, Any]) -> None:
+        device_id = reading["device_id"]
+        now = reading["timestamp_server"]
+        quality = reading.get("quality", 0)
+        self.last_seen[device_id] = now
+
+        plan = self.plans.get(device_id)
+        if plan is None:
+            plan = self.plan(device_id)
+        for field, groups in plan:
+            value = reading.get(field)
+            if not is_number(value) or field_flagged(quality, field):
+                continue
+            window = None
+            span = self.spans.get(field)
+            if span:
+                window = self.windows.get((device_id, field))
+                if window is None:
+                    window = self.windows[(device_id, field)] = Window(span)
+                window.add(now, value)
+
+            for group in groups:
+                observed = observe(group.key, value, window, now)
+                if observed is None:
+                    continue
+                slot = (device_id, group.key)
+                previous = self.observed.get(slot)
+                self.observed[slot] = observed
+                if previous is None:
+                    changed = group.rules
+                else:
+                    low, high = (previous, observed) if previous < observed else (observed, previous)
+                    limits = group.limits
+                    changed = group.rules[bisect_left(limits, low) : bisect_right(limits, high)]
+
+                for rule in changed:
+                    if self.update(rule, device_id, rule.compare(observed, rule.limit), observed, now):
+                        self.hold(slot, rule, device_id)
+                if slot in self.pending and now >= self.pending_due[slot]:
+                    self.recheck(slot, device_id, observed, now)
+
+    def hold(self, slot: Tuple[str, Tuple], rule: Rule, device_id: str) -> None:
+        waiting = self.pending.setdefault(slot, [])
+        if rule not in waiting:
+            waiting.append(rule)
+            due = self.states[(rule.name, device_id)].quiet_until
+            self.pending_due[slot] = min(due, self.pending_due.get(slot, due))
+
+    def recheck(self, slot: Tuple[str, Tuple], device_id: str, observed: float, now: int) -> None:
+        # A held rule whose condition cleared has crossed its limit and was
+        # reset by update() already; the rest fire now or wait some more.
+        waiting = [
+            rule
+            for rule in self.pending.pop(slot)
+            if self.update(rule, device_id, rule.compare(observed, rule.limit), observed, now)
+        ]
+        del self.pending_due[slot]
+        for rule in waiting:
+            self.hold(slot, rule, device_id)
+
+    def check_silent(self, now: Optional[int] = None) -> None:
+        now = int(time.time()) if now is None else now
+        for device_id, seen in list(self.last_seen.items()):
+            for rule in self.silent_rules:
+                if rule.devices is None or device_id in rule.devices:
+                    silence = now - seen
+                    self.update(rule, device_id, silence > rule.after, silence, now)
+
+    def update(self, rule: Rule, device_id: str, active: bool, observed: float, now: int) -> bool:
+        """Apply a rule's outcome; True while the hold-down keeps a true condition from firing."""
+        key = (rule.name, device_id)
+        state = self.states.get(key)
+        # Fast path: nothing to change.
+        if state is None:
+            if not active:
+                return False
+        elif state.firing == active and not state.held:
+            return False
+
+        with self.lock:
+            if state is None:
+                state = self.states.setdefault(key, AlertState())
+            if not active:
+                state.held = False
+                if state.firing:
+                    state.firing = False
+                    self.resolved += 1
+                    self.emit("resolved", rule, device_id, observed, now)
+                return False
+            if state.firing:
+                return False
+            if now < state.quiet_until:
+                if not state.held:
+                    state.held = True
+                    self.suppressed += 1
+                return True
+            state.held = False
+            state.firing = True
+            state.quiet_until = now + rule.hold_down
+            self.fired += 1
+            self.emit("firing", rule, device_id, observed, now)
+            return False
+
+    def emit(self, status: str, rule: Rule, device_id: str, observed: float, now: int) -> None:
+        if self.muted:
+            return
+        alert = {
+            "status": status,
+            "rule": rule.name,
+            "type": rule.type,
+            "device_id": device_id,
+            "observed": round(observed, 3),
+            "timestamp": now,
+            **rule.describe(),
+        }
+        log = logging.warning if status == "firing" else logging.info
+        log(f"Alert {rule.name} {status} for {device_id} (observed {alert['observed']})")
+        if self.sink:
+            self.sink.send(alert)
+
+    def warm(self, conn: sqlite3.Connection) -> None:
+        """Refill windows and alert states from stored rows, e.g. after a restart."""
+        latest: Dict[str, Dict[str, Any]] = {}
+        for device_id, last_seen, last_reading in conn.execute(
+            "SELECT device_id, last_seen, last_reading FROM device_state"
+        ):
+            self.last_seen[device_id] = last_seen
+            latest[device_id] = json.loads(last_reading)
+
+        self.muted = True
+        try:
+            replayed = set()
+            if self.spans:
+                fields = sorted({rule.field for rule in self.value_rules})
+                columns = ", ".join(["device_id", "timestamp_server", "quality", *fields])
+                since = int(time.time()) - max(self.spans.values())
+                cursor = conn.execute(
+                    f"""
+                    SELECT {columns}
+                    FROM measurements
+                    WHERE timestamp_server >= ?
+                    ORDER BY timestamp_server, id
+                    """,
+                    (since,),
+                )
+                names = [d[0] for d in cursor.description]
+                for row in cursor:
+                    reading = dict(zip(names, row))
+                    replayed.add(reading["device_id"])
+                    self.evaluate(reading)
+            # Threshold states only need the latest reading, however old; the
+            # devices replayed above already ended on theirs.
+            for device_id, reading in latest.items():
+                if device_id not in replayed:
+                    self.evaluate(reading)
+        finally:
+            self.muted = False
+            # Count only what happens from here on.
+            self.fired = self.resolved = self.suppressed = 0
+
+    def run_checks(self, interval: float) -> threading.Thread:
+        """Check silent rules every `interval` seconds on a daemon thread."""
+
+        def loop():
+            while True:
+                time.sleep(interval)
+                try:
+                    self.check_silent()
+                except Exception as e:
+                    logging.error(f"Silent device check failed: {e}")
+
+        thread = threading.Thread(target=loop, name="alert-checks", daemon=True)
+        thread.start()
+        return thread
+
+
+# ----------------------------
+# Delivery
+# ----------------------------
+
+
+class AlertSink:
+    """
+    Delivers alerts to a webhook (JSON POST) and/or a JSON lines file from a
+    background thread, so a slow endpoint never holds up ingest. When the
+    queue is full, new alerts are dropped and counted.
+    """
+
+    def __init__(self, webhook: str = "", path: str = ""):
+        self.webhook = webhook
+        self.path = path
+        self.queue: "queue.Queue[Dict[str, Any]]" = queue.Queue(maxsize=SINK_QUEUE_SIZE)
+        self.dropped = 0
+        self.failed = 0
+        threading.Thread(target=self._deliver, name="alert-sink", daemon=True).start()
+
+    def send(self, alert: Dict[str, Any]) -> None:
+        try:
+            self.queue.put_nowait(alert)
+        except queue.Full:
+            self.dropped += 1
+
+    def _deliver(self) -> None:
+        while True:
+            alert = self.queue.get()
+            body = json.dumps(alert, separators=(",", ":"))
+            if self.path:
+                try:
+                    with open(self.path, "a") as f:
+                        f.write(body + "\n")
+                except OSError as e:
+                    self.failed += 1
+                    logging.error(f"Cannot write alert to {self.path}: {e}")
+            if self.webhook:
+                request = urllib.request.Request(
+                    self.webhook,
+                    data=body.encode("utf-8"),
+                    headers={"Content-Type": "application/json"},
+                )
+                try:
+                    urllib.request.urlopen(request, timeout=WEBHOOK_TIMEOUT).close()
+                except OSError as e:
+                    self.failed += 1
+                    logging.error(f"Alert webhook {self.webhook} failed: {e}")
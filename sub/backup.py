@@ -0,0 +1,218 @@
+import argparse
+import logging
+import os
+import sqlite3
+import threading
+import time
+from datetime import datetime, timezone
+from pathlib import Path
+from typing import Any, Dict, List, Optional, Tuple
+from urllib.parse import quote
+
+from dotenv import load_dotenv
+
+# ----------------------------
+# Online snapshots of the database
+# ----------------------------
+#
+# Copying environment_data.db while main.py writes to it can produce a torn
+# copy. Snapshots are taken with SQLite's online backup API instead, from a
+# read-only connection, `step_pages` pages at a time with a `pause` between
+# steps, so the copy never competes with ingest for long:
+#
+#   - The copy runs inside one read transaction. In WAL mode that pins a
+#     consistent snapshot while main.py keeps committing; without it the
+#     backup API restarts from the first page whenever another connection
+#     writes, which with live ingest means it never finishes.
+#   - Readers never block the writer in WAL mode, but the WAL cannot be
+#     checkpointed past the pinned snapshot, so it grows for the duration of
+#     the copy and is folded back by the next checkpoint afterwards.
+#
+# Snapshots are written to `<name>.partial`, switched to a rollback journal so
+# each is a single self-contained file, and renamed into place once complete.
+# Only the newest `keep` are kept.
+
+load_dotenv()
+
+SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+BACKUP_DIR = os.getenv("BACKUP_DIR", "backups")
+BACKUP_STEP_PAGES = int(os.getenv("BACKUP_STEP_PAGES", "256"))
+BACKUP_STEP_PAUSE = float(os.getenv("BACKUP_STEP_PAUSE", "0.02"))
+BACKUP_KEEP = int(os.getenv("BACKUP_KEEP", "7"))
+
+
+class Snapshotter:
+    """Takes snapshots of one database into a directory, one at a time."""
+
+    def __init__(
+        self,
+        db_path: str,
+        directory: str,
+        step_pages: int = BACKUP_STEP_PAGES,
+        pause: float = BACKUP_STEP_PAUSE,
+        keep: int = BACKUP_KEEP,
+    ):
+        self.db_path = db_path
+        self.directory = Path(directory)
+        self.step_pages = step_pages
+        self.pause = pause
+        self.keep = keep
+        self.lock = threading.Lock()
+
+        # Progress of the running snapshot, read by status() from other threads.
+        self.running: Optional[str] = None
+        self.pages_done = 0
+        self.pages_total = 0
+        self.started = 0.0
+
+        self.last: Optional[Dict[str, Any]] = None
+        self.last_success = 0.0
+        self.completed = 0
+        self.failed = 0
+
+    def snapshots(self) -> List[Path]:
+        """Completed snapshots, oldest first."""
+        return [path for path, _ in self._snapshot_stats()]
+
+    def _snapshot_stats(self) -> List[Tuple[Path, os.stat_result]]:
+        # A snapshot can be pruned between the listing and its stat().
+        found = []
+        for path in self.directory.glob(f"{Path(self.db_path).stem}-*.db"):
+            try:
+                found.append((path, path.stat()))
+            except FileNotFoundError:
+                pass
+        return sorted(found, key=lambda f: (f[1].st_mtime, f[0].name))
+
+    def start(self) -> Optional[str]:
+        """Take a snapshot on a background thread; None if one is already running."""
+        if not self.lock.acquire(blocking=False):
+            return None
+        name = self._name()
+        self.running = name
+        threading.Thread(target=self._run_locked, args=(name,), name="backup", daemon=True).start()
+        return name
+
+    def run(self) -> Dict[str, Any]:
+        """Take a snapshot on this thread, waiting for a running one to finish first."""
+        with self.lock:
+            name = self._name()
+            self.running = name
+            return self._run(name)
+
+    def _run_locked(self, name: str) -> None:
+        try:
+            self._run(name)
+        except Exception:
+            pass  # logged and recorded in self.last by _run
+        finally:
+            self.lock.release()
+
+    def _name(self) -> str:
+        stamp = datetime.now(timezone.utc).strftime("%Y%m%d-%H%M%S")
+        name = f"{Path(self.db_path).stem}-{stamp}"
+        # Snapshots started within the same second get a counter.
+        n = 1
+        while (self.directory / f"{name}.db").exists():
+            n += 1
+            name = f"{Path(self.db_path).stem}-{stamp}-{n}"
+        return f"{name}.db"
+
+    def _progress(self, status: int, remaining: int, total: int) -> None:
+        self.pages_total = total
+        self.pages_done = total - remaining
+        if remaining and self.pause:
+            # Lets main.py's commits in between steps; the read transaction
+            # stays open, so the copy carries on from where it was.
+            time.sleep(self.pause)
+
+    def _run(self, name: str) -> Dict[str, Any]:
+        try:
+            return self._snapshot(name)
+        finally:
+            # Only once pruning is done, so the scheduler never lists a
+            # snapshot that is being deleted as the newest.
+            self.running = None
+
+    def _snapshot(self, name: str) -> Dict[str, Any]:
+        self.directory.mkdir(parents=True, exist_ok=True)
+        target = self.directory / name
+        partial = target.with_name(target.name + ".partial")
+        self.pages_done = self.pages_total = 0
+        self.started = time.time()
+        t0 = time.perf_counter()
+
+        uri = f"file:{quote(str(Path(self.db_path).resolve()))}?mode=ro"
+        source = sqlite3.connect(uri, uri=True, isolation_level=None)
+        dest = sqlite3.connect(partial, isolation_level=None)
+        try:
+            # Pin the snapshot before the first step.
+            source.execute("BEGIN")
+            source.execute("SELECT COUNT(*) FROM sqlite_master").fetchone()
+            source.backup(dest, pages=self.step_pages, progress=self._progress)
+            source.execute("COMMIT")
+            dest.execute("PRAGMA journal_mode=DELETE")
+            dest.close()
+            os.replace(partial, target)
+        except Exception as e:
+            dest.close()
+            partial.unlink(missing_ok=True)
+            self.failed += 1
+            self.last = {"name": name, "status": "failed", "error": str(e)}
+            logging.error(f"Backup {name} failed: {e}")
+            raise
+        finally:
+            source.close()
+
+        for old in self.snapshots()[: -self.keep] if self.keep > 0 else []:
+            old.unlink(missing_ok=True)
+
+        self.completed += 1
+        self.last_success = time.time()
+        self.last = {
+            "name": name,
+            "status": "ok",
+            "bytes": target.stat().st_size,
+            "pages": self.pages_total,
+            "seconds": round(time.perf_counter() - t0, 2),
+            "finished": int(self.last_success),
+        }
+        logging.info(
+            f"Backup {name}: {self.last['bytes'] / 1e6:.1f} MB in {self.last['seconds']}s"
+        )
+        return self.last
+
+    def status(self) -> Dict[str, Any]:
+        running = None
+        if self.running:
+            running = {
+                "name": self.running,
+                "pages_done": self.pages_done,
+                "pages_total": self.pages_total,
+                "seconds": round(time.time() - self.started, 1),
+            }
+        return {
+            "running": running,
+            "last": self.last,
+            "snapshots": [
+                {"name": p.name, "bytes": st.st_size} for p, st in self._snapshot_stats()
+            ],
+        }
+
+
+def main():
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
+
+    parser = argparse.ArgumentParser(description="Take an online snapshot of the database")
+    parser.add_argument("--db", default=SQLITE_DB, help="SQLite database (default: $SQLITE_DB)")
+    parser.add_argument("--dir", default=BACKUP_DIR, help="snapshot directory (default: $BACKUP_DIR)")
+    parser.add_argument("--step-pages", type=int, default=BACKUP_STEP_PAGES, help="pages per step, -1 for all")
+    parser.add_argument("--pause", type=float, default=BACKUP_STEP_PAUSE, help="seconds between steps")
+    parser.add_argument("--keep", type=int, default=BACKUP_KEEP, help="snapshots to keep, 0 for all")
+    args = parser.parse_args()
+
+    Snapshotter(args.db, args.dir, args.step_pages, args.pause, args.keep).run()
+
+
+if __name__ == "__main__":
+    main()
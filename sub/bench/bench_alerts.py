@@ -0,0 +1,147 @@
+"""
+Alert rule evaluation benchmark.
+
+Feeds synthetic readings from --devices devices, one every --interval
+seconds of simulated time each, through an AlertEngine with each number of
+rules in --rules and prints the evaluation cost per message. Rules are a mix
+of threshold, rate (windows up to 3 h) and RSSI degradation (24 h baseline)
+rules, a quarter of them limited to a few devices; one silent rule per
+hundred is timed separately, as it runs on a timer rather than per message.
+Nothing is delivered: the engine runs without a sink.
+
+    python bench/bench_alerts.py --rules 100 300 1000 --messages 200000
+"""
+
+import argparse
+import json
+import logging
+import random
+import sys
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+
+from alerts import AlertEngine, Rule  # noqa: E402
+
+THRESHOLDS = {
+    "dht22_temperature_c": (15, 25),
+    "dht22_humidity_percent": (40, 60),
+    "bmp280_temperature_c": (15, 25),
+    "bmp280_pressure_pa": (100000, 102000),
+    "free_heap": (150000, 200000),
+}
+
+
+def make_rules(count: int, devices: int, rng: random.Random):
+    specs = []
+    for i in range(count):
+        kind = ("threshold", "threshold", "rate", "degradation")[i % 4]
+        spec = {"name": f"rule-{i}", "type": kind}
+        if kind == "threshold":
+            field = rng.choice(list(THRESHOLDS))
+            low, high = THRESHOLDS[field]
+            op = rng.choice([">", "<"])
+            spec.update(field=field, op=op, value=high if op == ">" else low)
+        elif kind == "rate":
+            field = rng.choice(["bmp280_pressure_pa", "dht22_temperature_c"])
+            spec.update(
+                field=field,
+                window=rng.choice([600, 3600, 10800]),
+                op="<=",
+                value=-300 if field == "bmp280_pressure_pa" else -5,
+            )
+        else:
+            spec.update(field="rssi", window=600, baseline=86400, drop=10)
+        if i % 4 == 1:
+            spec["devices"] = [f"esp32-{rng.randrange(devices):03d}" for _ in range(3)]
+        specs.append(spec)
+    for i in range(max(1, count // 100)):
+        specs.append({"name": f"silent-{i}", "type": "silent", "after": 600})
+    return [Rule(spec) for spec in specs]
+
+
+def readings(devices: int, messages: int, interval: int, rng: random.Random):
+    state = {
+        f"esp32-{d:03d}": {
+            "dht22_temperature_c": 20.0,
+            "dht22_humidity_percent": 50.0,
+            "bmp280_temperature_c": 20.0,
+            "bmp280_pressure_pa": 101000.0,
+            "rssi": -60,
+            "free_heap": 180000,
+        }
+        for d in range(devices)
+    }
+    names = list(state)
+    start = int(time.time()) - messages // devices * interval
+    for i in range(messages):
+        device_id = names[i % devices]
+        values = state[device_id]
+        # Random walks pulled back towards typical values.
+        values["dht22_temperature_c"] += rng.gauss(0, 0.1) + (20 - values["dht22_temperature_c"]) * 0.01
+        values["dht22_humidity_percent"] += rng.gauss(0, 0.3) + (50 - values["dht22_humidity_percent"]) * 0.01
+        values["bmp280_temperature_c"] += rng.gauss(0, 0.1) + (20 - values["bmp280_temperature_c"]) * 0.01
+        values["bmp280_pressure_pa"] += rng.gauss(0, 5) + (101000 - values["bmp280_pressure_pa"]) * 0.01
+        values["rssi"] = max(-95, min(-30, values["rssi"] + rng.choice((-1, 0, 1))))
+        values["free_heap"] += round(rng.gauss(0, 500) + (180000 - values["free_heap"]) * 0.01)
+        yield {
+            "device_id": device_id,
+            "timestamp_server": start + i // devices * interval,
+            "quality": 0,
+            **values,
+        }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Alert rule evaluation benchmark")
+    parser.add_argument("--rules", type=int, nargs="+", default=[0, 100, 300, 1000])
+    parser.add_argument("--devices", type=int, default=50)
+    parser.add_argument("--messages", type=int, default=200000)
+    parser.add_argument("--interval", type=int, default=10, help="seconds between readings per device")
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    # Firing alerts are logged; keep them out of the timing.
+    logging.disable(logging.WARNING)
+
+    results = []
+    for count in args.rules:
+        rng = random.Random(1)
+        engine = AlertEngine(make_rules(count, args.devices, rng))
+        batch = list(readings(args.devices, args.messages, args.interval, rng))
+
+        t0 = time.perf_counter()
+        for reading in batch:
+            engine.evaluate(reading)
+        elapsed = time.perf_counter() - t0
+
+        t0 = time.perf_counter()
+        engine.check_silent()
+        silent = time.perf_counter() - t0
+
+        result = {
+            "rules": count,
+            "us_per_message": round(elapsed / len(batch) * 1e6, 2),
+            "messages_per_s": round(len(batch) / elapsed),
+            "silent_check_ms": round(silent * 1000, 2),
+            "fired": engine.fired,
+            "resolved": engine.resolved,
+            "suppressed": engine.suppressed,
+            "window_samples": sum(len(w.times) - w.start for w in engine.windows.values()),
+        }
+        results.append(result)
+        if not args.json:
+            print(
+                f"{count:5d} rules: {result['us_per_message']:8.2f} us/message "
+                f"({result['messages_per_s']} msg/s), silent check {result['silent_check_ms']} ms, "
+                f"fired {result['fired']}, suppressed {result['suppressed']}, "
+                f"{result['window_samples']} samples in windows"
+            )
+
+    if args.json:
+        print(json.dumps(results, indent=2))
+
+
+if __name__ == "__main__":
+    main()
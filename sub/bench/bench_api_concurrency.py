@@ -0,0 +1,110 @@
+"""
+Concurrency benchmark for the dashboard API.
+
+Simulates --clients dashboard tabs, each replaying the fetch pattern of
+static/dashboard.js against a running web_server.py, and prints p50/p99
+latency per endpoint.
+
+    python bench/seed_db.py --db /tmp/bench.db --devices 4 --days 30
+    SQLITE_DB=/tmp/bench.db uvicorn web_server:app --port 8080
+    python bench/bench_api_concurrency.py --url http://127.0.0.1:8080 --clients 16
+"""
+
+import argparse
+import json
+import statistics
+import threading
+import time
+import urllib.request
+from collections import defaultdict
+
+# One dashboard refresh cycle (updateDataInBackground + history reload).
+DASHBOARD_CYCLE = [
+    "/api/health",
+    "/api/devices/status",
+    "/api/data/latest?limit=5",
+    "/api/data/history?hours=1&limit=100",
+    "/api/stats",
+    "/api/data/history?hours=24&limit=1000",
+]
+
+
+def percentile(values, pct):
+    if not values:
+        return float("nan")
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def client_loop(base_url, deadline, latencies, errors, lock):
+    local = defaultdict(list)
+    local_errors = defaultdict(int)
+
+    while time.monotonic() < deadline:
+        for path in DASHBOARD_CYCLE:
+            endpoint = path.split("?")[0]
+            t0 = time.perf_counter()
+            try:
+                with urllib.request.urlopen(base_url + path, timeout=30) as response:
+                    response.read()
+                local[endpoint].append((time.perf_counter() - t0) * 1000)
+            except Exception:
+                local_errors[endpoint] += 1
+
+    with lock:
+        for endpoint, values in local.items():
+            latencies[endpoint].extend(values)
+        for endpoint, count in local_errors.items():
+            errors[endpoint] += count
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Dashboard API concurrency benchmark")
+    parser.add_argument("--url", default="http://127.0.0.1:8080")
+    parser.add_argument("--clients", type=int, default=8)
+    parser.add_argument("--duration", type=float, default=20, help="seconds")
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    latencies = defaultdict(list)
+    errors = defaultdict(int)
+    lock = threading.Lock()
+    deadline = time.monotonic() + args.duration
+
+    threads = [
+        threading.Thread(
+            target=client_loop, args=(args.url, deadline, latencies, errors, lock), daemon=True
+        )
+        for _ in range(args.clients)
+    ]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    results = {}
+    for endpoint in sorted(set(latencies) | set(errors)):
+        values = latencies[endpoint]
+        results[endpoint] = {
+            "requests": len(values),
+            "errors": errors[endpoint],
+            "p50_ms": round(percentile(values, 50), 2),
+            "p99_ms": round(percentile(values, 99), 2),
+            "mean_ms": round(statistics.fmean(values), 2) if values else None,
+        }
+
+    if args.json:
+        print(json.dumps({"clients": args.clients, "endpoints": results}, indent=2))
+        return
+
+    print(f"{args.clients} clients, {args.duration:.0f}s")
+    print(f"{'endpoint':<28}{'reqs':>8}{'errs':>6}{'p50 ms':>10}{'p99 ms':>10}")
+    for endpoint, r in results.items():
+        print(
+            f"{endpoint:<28}{r['requests']:>8}{r['errors']:>6}{r['p50_ms']:>10.1f}{r['p99_ms']:>10.1f}"
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,168 @@
+"""
+Ingest latency while an online snapshot runs.
+
+Writes measurements at a fixed rate with the same insert + commit per
+message as main.py, and measures each commit's latency three times: with
+no backup, with a backup.py snapshot at its throttled defaults, and with
+an unthrottled one (all pages in one step). The snapshot runs in a
+separate process, as it would next to main.py. Scenarios are interleaved
+for --rounds rounds and their latencies pooled, as single runs are noisy
+(commits fsync, and disk writeback shows up in every scenario). Prints
+latency percentiles per scenario and the median snapshot time.
+
+    python bench/seed_db.py --db /tmp/big.db --devices 30 --days 70
+    python bench/bench_backup.py --db /tmp/big.db --rate 200
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import sqlite3
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+SUB_DIR = Path(__file__).resolve().parent.parent
+sys.path.insert(0, str(SUB_DIR))
+
+from backup import BACKUP_STEP_PAGES, BACKUP_STEP_PAUSE  # noqa: E402
+from derived import DerivedFields  # noqa: E402
+from storage import init_db, insert_measurement  # noqa: E402
+from bench_api_concurrency import percentile  # noqa: E402
+
+SCENARIOS = (
+    ("no backup", None),
+    (f"backup, {BACKUP_STEP_PAGES} pages/step + {BACKUP_STEP_PAUSE}s", (BACKUP_STEP_PAGES, BACKUP_STEP_PAUSE)),
+    ("backup, unthrottled", (-1, 0.0)),
+)
+
+
+def ingest(conn, derived, rng, devices: int, rate: float, until, first: int):
+    """Insert at `rate` msg/s until `until()` is true; returns commit latencies in ms."""
+    latencies = []
+    interval = 1 / rate
+    next_at = time.perf_counter()
+    i = first
+    while not until():
+        device_id = f"esp32-bench-{i % devices:02d}"
+        now = int(time.time())
+        measurement = {
+            "device_id": device_id,
+            "topic": f"sensors/{device_id}/environment",
+            "dht22_temperature_c": round(rng.uniform(15, 25), 2),
+            "dht22_humidity_percent": round(rng.uniform(40, 60), 2),
+            "bmp280_temperature_c": round(rng.uniform(15, 25), 2),
+            "bmp280_pressure_pa": round(rng.uniform(100000, 102000), 2),
+            "timestamp_device": now,
+            "timestamp_server": now,
+            "firmware_version": "1.0.0",
+            "rssi": rng.randint(-80, -45),
+            "altitude_m": 12.0,
+            "free_heap": 250000,
+            "quality": 0,
+        }
+        derived.fill(measurement)
+        t0 = time.perf_counter()
+        insert_measurement(conn, measurement)
+        conn.commit()
+        latencies.append((time.perf_counter() - t0) * 1000)
+        i += 1
+
+        next_at += interval
+        delay = next_at - time.perf_counter()
+        if delay > 0:
+            time.sleep(delay)
+    return latencies
+
+
+def summarize(name: str, latencies, backup_seconds=None):
+    return {
+        "scenario": name,
+        "messages": len(latencies),
+        "p50_ms": round(percentile(latencies, 50), 3),
+        "p99_ms": round(percentile(latencies, 99), 3),
+        "max_ms": round(max(latencies), 3),
+        "backup_s": backup_seconds,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Ingest latency during an online backup")
+    parser.add_argument("--db", required=True, help="database to copy and write to")
+    parser.add_argument("--rate", type=float, default=200, help="messages per second")
+    parser.add_argument("--devices", type=int, default=8)
+    parser.add_argument("--baseline", type=float, default=20, help="seconds of ingest without a backup")
+    parser.add_argument("--rounds", type=int, default=3, help="times each scenario runs")
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        db_path = Path(tmp) / "bench.db"
+        shutil.copy(args.db, db_path)
+        conn = sqlite3.connect(db_path)
+        init_db(conn)
+        derived = DerivedFields()
+        rng = random.Random(1)
+        written = 0
+
+        # Start from a clean page cache state rather than the copy's writeback.
+        os.sync()
+
+        latencies = {name: [] for name, _ in SCENARIOS}
+        backup_seconds = {name: [] for name, _ in SCENARIOS}
+        for _ in range(args.rounds):
+            for name, backup in SCENARIOS:
+                if backup is None:
+                    deadline = time.perf_counter() + args.baseline
+                    run = ingest(conn, derived, rng, args.devices, args.rate,
+                                 lambda: time.perf_counter() > deadline, written)
+                else:
+                    step_pages, pause = backup
+                    t0 = time.perf_counter()
+                    proc = subprocess.Popen(
+                        [
+                            sys.executable, str(SUB_DIR / "backup.py"),
+                            "--db", str(db_path), "--dir", str(Path(tmp) / "backups"),
+                            "--step-pages", str(step_pages), "--pause", str(pause), "--keep", "1",
+                        ],
+                        stderr=subprocess.DEVNULL,
+                    )
+                    run = ingest(conn, derived, rng, args.devices, args.rate,
+                                 lambda: proc.poll() is not None, written)
+                    if proc.returncode != 0:
+                        raise SystemExit(f"backup.py exited with {proc.returncode}")
+                    backup_seconds[name].append(time.perf_counter() - t0)
+                latencies[name].extend(run)
+                written += len(run)
+                # Fold the WAL back before the next scenario, as the autocheckpoint would.
+                conn.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+        conn.close()
+
+    results = [
+        summarize(
+            name,
+            latencies[name],
+            round(statistics.median(backup_seconds[name]), 1) if backup_seconds[name] else None,
+        )
+        for name, _ in SCENARIOS
+    ]
+    if args.json:
+        print(json.dumps(results, indent=2))
+        return
+    print(f"{args.rate:g} msg/s, commit latency:")
+    print(f"  {'scenario':<34} {'msgs':>6} {'p50 ms':>8} {'p99 ms':>8} {'max ms':>8} {'backup s':>9}")
+    for r in results:
+        backup_s = "" if r["backup_s"] is None else r["backup_s"]
+        print(
+            f"  {r['scenario']:<34} {r['messages']:>6} {r['p50_ms']:>8} {r['p99_ms']:>8} "
+            f"{r['max_ms']:>8} {backup_s:>9}"
+        )
+
+
+if __name__ == "__main__":
+    main()
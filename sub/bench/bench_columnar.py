@@ -0,0 +1,91 @@
+"""
+Row vs columnar JSON for the history endpoint.
+
+Builds the /api/data/history response for the same rows as FastAPI would
+serve each format: rows as one dict per row through jsonable_encoder, and
+columnar (with and without delta encoding) straight to json.dumps. Prints
+the query + serialize time and the payload size, plain and gzipped.
+
+    python bench/bench_columnar.py --db /tmp/bench.db --limit 10000
+"""
+
+import argparse
+import gzip
+import json
+import sqlite3
+import sys
+import time
+from pathlib import Path
+from urllib.parse import quote
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+
+from fastapi.encoders import jsonable_encoder  # noqa: E402
+
+from columnar import columns_from_cursor, delta_decode  # noqa: E402
+
+
+def render(content) -> bytes:
+    # Same settings as starlette's JSONResponse.
+    return json.dumps(content, ensure_ascii=False, allow_nan=False, separators=(",", ":")).encode("utf-8")
+
+
+def rows_format(conn, query, params) -> bytes:
+    conn.row_factory = sqlite3.Row
+    rows = conn.execute(query, params).fetchall()
+    conn.row_factory = None
+    return render(jsonable_encoder({"data": [dict(row) for row in rows]}))
+
+
+def columnar_format(conn, query, params, delta) -> bytes:
+    return render(columns_from_cursor(conn.execute(query, params), delta))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Row vs columnar JSON benchmark")
+    parser.add_argument("--db", required=True)
+    parser.add_argument("--limit", type=int, default=10000)
+    parser.add_argument("--repeat", type=int, default=10)
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(f"file:{quote(str(Path(args.db).resolve()))}?mode=ro", uri=True)
+    query = "SELECT * FROM measurements ORDER BY timestamp_server DESC LIMIT ?"
+    params = (args.limit,)
+
+    variants = {
+        "rows": lambda: rows_format(conn, query, params),
+        "columnar": lambda: columnar_format(conn, query, params, False),
+        "columnar_delta": lambda: columnar_format(conn, query, params, True),
+    }
+
+    # Both columnar forms must describe the same rows.
+    plain = json.loads(variants["columnar"]())
+    packed = json.loads(variants["columnar_delta"]())
+    for name in packed["delta"]:
+        assert delta_decode(packed["columns"][name]) == plain["columns"][name], name
+
+    results = {}
+    for name, build in variants.items():
+        timings = []
+        for _ in range(args.repeat):
+            t0 = time.perf_counter()
+            body = build()
+            timings.append((time.perf_counter() - t0) * 1000)
+        results[name] = {
+            "ms": round(sorted(timings)[len(timings) // 2], 1),
+            "bytes": len(body),
+            "gzip_bytes": len(gzip.compress(body, 6)),
+        }
+
+    if args.json:
+        print(json.dumps({"rows": plain["count"], "results": results}, indent=2))
+        return
+
+    print(f"{plain['count']} rows")
+    for name, r in results.items():
+        print(f"{name:>15}: {r['ms']:7.1f} ms  {r['bytes']:>9} bytes  {r['gzip_bytes']:>8} gzipped")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,78 @@
+"""
+Per-endpoint latency benchmark for the dashboard API.
+
+Requests every read endpoint of web_server.py one at a time, with the
+parameters the dashboard and typical API users send, and prints p50/p99
+per request. Single client on purpose: it measures query cost, not
+contention (see bench_api_concurrency.py for that).
+
+    SQLITE_DB=/tmp/bench.db uvicorn web_server:app --port 8080
+    python bench/bench_endpoints.py --url http://127.0.0.1:8080 --device esp32-bench-00
+"""
+
+import argparse
+import json
+import statistics
+import time
+import urllib.request
+
+from bench_api_concurrency import percentile
+
+FIELDS = "dht22_temperature_c,bmp280_pressure_pa"
+
+
+def endpoint_paths(device_id, now):
+    day = now - 86400
+    return [
+        "/api/health",
+        "/api/stats",
+        "/api/devices/status",
+        f"/api/devices/{device_id}/latest",
+        "/api/data/latest?limit=10",
+        "/api/data/history?hours=24&limit=1000",
+        f"/api/data/history?device_id={device_id}&hours=24&limit=1000",
+        f"/api/data/history?device_id={device_id}&hours=168&limit=10000",
+        f"/api/data/history?hours=168&points=800&fields={FIELDS}",
+        f"/api/data/history?device_id={device_id}&hours=168&points=800&fields={FIELDS}",
+        "/api/data/aggregated?hours=168&interval_minutes=60",
+        f"/api/data/aggregated?device_id={device_id}&hours=168&interval_minutes=60",
+        f"/api/export?format=csv&device_id={device_id}&start={day}",
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Per-endpoint API latency benchmark")
+    parser.add_argument("--url", default="http://127.0.0.1:8080")
+    parser.add_argument("--device", default="esp32-bench-00", help="device used for per-device requests")
+    parser.add_argument("--repeat", type=int, default=20)
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    results = {}
+    for path in endpoint_paths(args.device, int(time.time())):
+        values = []
+        size = 0
+        # One warm-up request so every run starts with the same page cache.
+        for i in range(args.repeat + 1):
+            t0 = time.perf_counter()
+            with urllib.request.urlopen(args.url + path, timeout=60) as response:
+                size = len(response.read())
+            if i:
+                values.append((time.perf_counter() - t0) * 1000)
+        results[path] = {
+            "bytes": size,
+            "p50_ms": round(percentile(values, 50), 2),
+            "p99_ms": round(percentile(values, 99), 2),
+            "mean_ms": round(statistics.fmean(values), 2),
+        }
+
+    if args.json:
+        print(json.dumps({"repeat": args.repeat, "endpoints": results}, indent=2))
+        return
+
+    for path, r in results.items():
+        print(f"{path:<92}{r['p50_ms']:>9.1f}{r['p99_ms']:>9.1f}  ms p50/p99")
+
+
+if __name__ == "__main__":
+    main()
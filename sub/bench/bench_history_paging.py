@@ -0,0 +1,129 @@
+"""
+Keyset vs OFFSET pagination of history rows.
+
+Pages through the whole measurements table with the queries
+/api/data/history runs (paging.py): once across all devices newest first,
+once for one device oldest first. Prints per-page latency overall and by
+depth, then the cost of reaching the same depths with LIMIT/OFFSET, which
+reads and discards every skipped row.
+
+    python bench/seed_db.py --db /tmp/big.db --devices 30 --days 70
+    python bench/bench_history_paging.py --db /tmp/big.db --limit 1000
+"""
+
+import argparse
+import json
+import sqlite3
+import statistics
+import sys
+import time
+from pathlib import Path
+from urllib.parse import quote
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+
+from paging import PageQuery  # noqa: E402
+
+DEPTHS = (0.0, 0.25, 0.5, 0.75, 0.99)
+
+
+def ms(seconds: float) -> float:
+    return round(seconds * 1000, 2)
+
+
+def traverse(conn: sqlite3.Connection, page: PageQuery, limit: int):
+    """Fetch every page, returning the time of each and the rows read."""
+    times = []
+    rows = 0
+    while True:
+        query, params = page.sql("*", None, limit + 1)
+        t0 = time.perf_counter()
+        cursor = conn.execute(query, params)
+        batch = cursor.fetchall()
+        times.append(time.perf_counter() - t0)
+        rows += min(len(batch), limit)
+        if len(batch) <= limit:
+            return times, rows
+        names = [d[0] for d in cursor.description]
+        last = batch[limit - 1]
+        key = (last[names.index("timestamp_server")], last[names.index("id")])
+        page = PageQuery(page.device_id, page.start, page.end, page.quality, page.order, key)
+
+
+def offset_page(conn: sqlite3.Connection, device_id, order: str, limit: int, offset: int) -> float:
+    where = "WHERE device_id = ?" if device_id else ""
+    params = [device_id] if device_id else []
+    direction = order.upper()
+    t0 = time.perf_counter()
+    conn.execute(
+        f"""
+        SELECT * FROM measurements {where}
+        ORDER BY timestamp_server {direction}, id {direction}
+        LIMIT ? OFFSET ?
+        """,
+        [*params, limit, offset],
+    ).fetchall()
+    return time.perf_counter() - t0
+
+
+def run(conn: sqlite3.Connection, name: str, device_id, order: str, limit: int):
+    t0 = time.perf_counter()
+    times, rows = traverse(conn, PageQuery(device_id, None, None, "all", order), limit)
+    total = time.perf_counter() - t0
+
+    by_depth = {}
+    offsets = {}
+    for depth in DEPTHS:
+        index = min(int(depth * len(times)), len(times) - 1)
+        # Median of the pages around this depth.
+        around = times[max(0, index - 5): index + 5]
+        by_depth[f"{depth:.0%}"] = ms(statistics.median(around))
+        offsets[f"{depth:.0%}"] = ms(offset_page(conn, device_id, order, limit, index * limit))
+
+    ordered = sorted(times)
+    return {
+        "scenario": name,
+        "rows": rows,
+        "pages": len(times),
+        "seconds": round(total, 2),
+        "rows_per_s": round(rows / total),
+        "page_ms_p50": ms(ordered[len(ordered) // 2]),
+        "page_ms_p95": ms(ordered[int(len(ordered) * 0.95)]),
+        "page_ms_max": ms(ordered[-1]),
+        "keyset_ms_by_depth": by_depth,
+        "offset_ms_by_depth": offsets,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Keyset vs OFFSET history pagination benchmark")
+    parser.add_argument("--db", required=True)
+    parser.add_argument("--limit", type=int, default=1000, help="rows per page")
+    parser.add_argument("--device", help="device for the per-device run (default: the first)")
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(f"file:{quote(str(Path(args.db).resolve()))}?mode=ro", uri=True)
+    device_id = args.device or conn.execute("SELECT MIN(device_id) FROM device_state").fetchone()[0]
+
+    results = [
+        run(conn, "all devices, newest first", None, "desc", args.limit),
+        run(conn, f"{device_id}, oldest first", device_id, "asc", args.limit),
+    ]
+
+    if args.json:
+        print(json.dumps(results, indent=2))
+        return
+    for r in results:
+        print(
+            f"{r['scenario']}: {r['rows']} rows in {r['pages']} pages of {args.limit}, "
+            f"{r['seconds']} s ({r['rows_per_s']} rows/s); page p50 {r['page_ms_p50']} ms, "
+            f"p95 {r['page_ms_p95']} ms, max {r['page_ms_max']} ms"
+        )
+        print(f"  {'depth':>6} {'keyset ms':>10} {'offset ms':>10}")
+        for depth, keyset in r["keyset_ms_by_depth"].items():
+            print(f"  {depth:>6} {keyset:>10} {r['offset_ms_by_depth'][depth]:>10}")
+
+
+if __name__ == "__main__":
+    main()
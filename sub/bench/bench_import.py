@@ -0,0 +1,132 @@
+"""
+Bulk import benchmark.
+
+Writes a JSONL archive of mqtt_pub.c payloads (--lines lines for --devices
+nodes at one reading a minute, ending now, with --dup-ratio of the lines
+repeated and a few malformed ones), then imports it with import_archive.py
+into a copy of --db, once per --workers value. Each copy is then imported
+into a second time, when every line is a duplicate. Prints lines/s and
+rows/s of each run.
+
+    python bench/seed_db.py --db /tmp/bench.db --devices 4 --days 30
+    python bench/bench_import.py --db /tmp/bench.db --lines 3000000 --workers 0 1 2
+"""
+
+import argparse
+import json
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+SUB_DIR = Path(__file__).resolve().parent.parent
+
+BAD_LINES = (b"{not json\n", b'"a string"\n', b'{"device_id": "x"}\n')
+
+
+def write_archive(path: Path, lines: int, devices: int, dup_ratio: float) -> None:
+    rng = random.Random(1)
+    readings = int(lines / (1 + dup_ratio))
+    start = int(time.time()) - (readings // devices) * 60
+    state = [
+        {"t": rng.uniform(10, 25), "h": rng.uniform(40, 70), "p": rng.uniform(99500, 102000)}
+        for _ in range(devices)
+    ]
+    recent = []
+    with open(path, "wb") as f:
+        for i in range(readings):
+            n = i % devices
+            s = state[n]
+            # Random walks pulled back towards typical values, so the
+            # readings stay within quality.py's ranges.
+            s["t"] += 0.001 * (17 - s["t"]) + rng.gauss(0, 0.05)
+            s["h"] = min(100, max(5, s["h"] + 0.001 * (55 - s["h"]) + rng.gauss(0, 0.2)))
+            s["p"] += 0.001 * (101000 - s["p"]) + rng.gauss(0, 3)
+            line = json.dumps(
+                {
+                    "device_id": f"esp32-import-{n:02d}",
+                    "fw": "1.0.0",
+                    "ts_device": start + (i // devices) * 60,
+                    "rssi": rng.randint(-80, -45),
+                    "altitude_m": 120.5,
+                    "free_heap": 250000,
+                    "dht22": {"temperature_c": round(s["t"], 2), "humidity_percent": round(s["h"], 2)},
+                    "bmp280": {"temperature_c": round(s["t"] + 0.8, 2), "pressure_pa": round(s["p"], 2)},
+                },
+                separators=(",", ":"),
+            ).encode() + b"\n"
+            f.write(line)
+            # Overlapping dumps repeat recent lines.
+            recent.append(line)
+            if len(recent) > 1000:
+                recent = recent[-500:]
+            if rng.random() < dup_ratio:
+                f.write(rng.choice(recent))
+            if i % 100000 == 0:
+                f.write(rng.choice(BAD_LINES))
+
+
+def run_import(db: Path, archive: Path, workers: int) -> dict:
+    t0 = time.perf_counter()
+    result = subprocess.run(
+        [sys.executable, str(SUB_DIR / "import_archive.py"), str(archive), "--db", str(db), "--workers", str(workers)],
+        capture_output=True,
+        text=True,
+    )
+    elapsed = time.perf_counter() - t0
+    if result.returncode != 0:
+        raise SystemExit(result.stderr)
+    imported = re.search(r"Imported (\d+) of (\d+) lines", result.stderr)
+    inserted, lines = int(imported.group(1)), int(imported.group(2))
+    return {
+        "workers": workers,
+        "lines": lines,
+        "rows": inserted,
+        "seconds": round(elapsed, 1),
+        "lines_per_s": round(lines / elapsed),
+        "rows_per_s": round(inserted / elapsed),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Bulk import benchmark")
+    parser.add_argument("--db", required=True, help="database to copy and import into")
+    parser.add_argument("--lines", type=int, default=1000000)
+    parser.add_argument("--devices", type=int, default=10)
+    parser.add_argument("--dup-ratio", type=float, default=0.05)
+    parser.add_argument("--workers", type=int, nargs="+", default=[0, 1, 2, 4])
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        archive = Path(tmp) / "archive.jsonl"
+        write_archive(archive, args.lines, args.devices, args.dup_ratio)
+        for workers in args.workers:
+            db = Path(tmp) / "import.db"
+            shutil.copy(args.db, db)
+            first = run_import(db, archive, workers)
+            again = run_import(db, archive, workers)
+            results.append({"first": first, "again": again})
+            db.unlink()
+            for suffix in ("-wal", "-shm"):
+                Path(f"{db}{suffix}").unlink(missing_ok=True)
+
+    if args.json:
+        print(json.dumps(results, indent=2))
+        return
+    print(f"  {'workers':>7} {'lines':>9} {'rows':>9} {'s':>7} {'lines/s':>9} {'rows/s':>9} {'re-import s':>12}")
+    for r in results:
+        first, again = r["first"], r["again"]
+        print(
+            f"  {first['workers']:>7} {first['lines']:>9} {first['rows']:>9} {first['seconds']:>7} "
+            f"{first['lines_per_s']:>9} {first['rows_per_s']:>9} {again['seconds']:>12}"
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,102 @@
+"""
+Ingest write-path benchmark.
+
+Runs the same insert + commit per message as main.py against a database
+(for example one made by seed_db.py) and prints throughput, commit latency
+percentiles and WAL pages written per message (one per B-tree page the
+commit touched). Rows are written for --devices bench devices with
+current timestamps, like live traffic appended to existing history.
+
+    python bench/bench_ingest.py --db /tmp/bench.db --messages 20000
+"""
+
+import argparse
+import json
+import random
+import sqlite3
+import sys
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+
+from derived import DerivedFields  # noqa: E402
+from storage import init_db, insert_measurement  # noqa: E402
+from bench_api_concurrency import percentile  # noqa: E402
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Ingest write-path benchmark")
+    parser.add_argument("--db", required=True)
+    parser.add_argument("--messages", type=int, default=20000)
+    parser.add_argument("--devices", type=int, default=8)
+    parser.add_argument(
+        "--synchronous", choices=["OFF", "NORMAL", "FULL"], help="default: as main.py (SQLite default)"
+    )
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(args.db)
+    init_db(conn)
+    if args.synchronous:
+        conn.execute(f"PRAGMA synchronous={args.synchronous}")
+
+    # Checkpoint by hand so every WAL frame is counted exactly once.
+    conn.execute("PRAGMA wal_autocheckpoint=0")
+    wal_frames = 0
+
+    derived = DerivedFields()
+    rng = random.Random(1)
+    now = int(time.time())
+    latencies = []
+    t_start = time.perf_counter()
+
+    for i in range(args.messages):
+        device_id = f"esp32-bench-{i % args.devices:02d}"
+        measurement = {
+            "device_id": device_id,
+            "topic": f"sensors/{device_id}/environment",
+            "dht22_temperature_c": round(rng.uniform(15, 25), 2),
+            "dht22_humidity_percent": round(rng.uniform(40, 60), 2),
+            "bmp280_temperature_c": round(rng.uniform(15, 25), 2),
+            "bmp280_pressure_pa": round(rng.uniform(100000, 102000), 2),
+            "timestamp_device": now + i // args.devices,
+            "timestamp_server": now + i // args.devices,
+            "firmware_version": "1.0.0",
+            "rssi": rng.randint(-80, -45),
+            "altitude_m": 12.0,
+            "free_heap": 250000,
+            "quality": 0,
+        }
+        derived.fill(measurement)
+        t0 = time.perf_counter()
+        insert_measurement(conn, measurement)
+        conn.commit()
+        latencies.append((time.perf_counter() - t0) * 1000)
+
+        if i % 500 == 499 or i == args.messages - 1:
+            wal_frames += conn.execute("PRAGMA wal_checkpoint(RESTART)").fetchone()[1]
+
+    elapsed = time.perf_counter() - t_start
+    conn.close()
+
+    result = {
+        "messages": args.messages,
+        "messages_per_s": round(args.messages / elapsed),
+        "p50_ms": round(percentile(latencies, 50), 3),
+        "p99_ms": round(percentile(latencies, 99), 3),
+        "max_ms": round(max(latencies), 3),
+        "wal_pages_per_message": round(wal_frames / args.messages, 2),
+    }
+    if args.json:
+        print(json.dumps(result, indent=2))
+    else:
+        print(
+            f"{result['messages']} messages, {result['messages_per_s']} msg/s, "
+            f"commit p50 {result['p50_ms']} ms, p99 {result['p99_ms']} ms, max {result['max_ms']} ms, "
+            f"{result['wal_pages_per_message']} WAL pages/message"
+        )
+
+
+if __name__ == "__main__":
+    main()
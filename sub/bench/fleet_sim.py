@@ -0,0 +1,396 @@
+"""
+Fleet simulator and end-to-end load benchmark.
+
+Simulates --nodes ESP32 nodes publishing the topic and payload of
+pub/main/mqtt_pub.c to an MQTT broker that main.py is subscribed to, while
+--api-clients dashboard tabs replay the fetch pattern of static/dashboard.js
+against web_server.py. Reports ingest throughput, publish-to-row latency,
+dropped messages and API latency, and writes them as JSON for comparison
+with earlier runs.
+
+Rows are matched back to publishes through the database main.py writes to:
+each simulated node reports its own message counter as free_heap.
+
+    mosquitto -p 1883 &
+    SQLITE_DB=/tmp/load.db python main.py &
+    SQLITE_DB=/tmp/load.db uvicorn web_server:app --port 8080 &
+    python bench/fleet_sim.py --db /tmp/load.db --nodes 200 --interval 5 \\
+        --duration 60 --api http://127.0.0.1:8080 --output results.json
+    python bench/fleet_sim.py ... --baseline results.json   # exit 1 on regression
+"""
+
+import argparse
+import heapq
+import json
+import os
+import random
+import sqlite3
+import sys
+import threading
+import time
+from collections import defaultdict, deque
+from urllib.parse import quote
+
+import paho.mqtt.client as mqtt
+
+from bench_api_concurrency import client_loop, percentile
+
+# Byte for byte the format string of mqtt_publish_measurement().
+PAYLOAD_FORMAT = (
+    '{"device_id":"%s","fw":"%s","ts_device":%d,"rssi":%d,"altitude_m":%.1f,'
+    '"free_heap":%d,"dht22":{"temperature_c":%.2f,"humidity_percent":%.2f},'
+    '"bmp280":{"temperature_c":%.2f,"pressure_pa":%.2f}}'
+)
+TOPIC_FORMAT = "sensors/%s/environment"
+
+BAD_KINDS = ("truncated", "garbage", "non_object", "wrong_types")
+
+
+class Node:
+    def __init__(self, index: int, prefix: str, fw: str, rng: random.Random):
+        self.device_id = f"{prefix}-{index:04d}"
+        self.topic = TOPIC_FORMAT % self.device_id
+        self.fw = fw
+        self.seq = 0
+        self.temp = rng.uniform(15, 25)
+        self.rh = rng.uniform(40, 60)
+        self.press = rng.uniform(100500, 102000)
+
+    def payload(self, rng: random.Random) -> str:
+        self.seq += 1
+        self.temp += rng.gauss(0, 0.05)
+        self.rh = min(100.0, max(0.0, self.rh + rng.gauss(0, 0.2)))
+        self.press += rng.gauss(0, 2)
+        # The DHT22 fails a read now and then; the firmware sends -999.
+        dht_temp, dht_rh = (-999.0, -999.0) if rng.random() < 0.005 else (self.temp + 0.4, self.rh)
+        altitude = 44330.0 * (1.0 - (self.press / 101325.0) ** (1 / 5.225))
+        return PAYLOAD_FORMAT % (
+            self.device_id,
+            self.fw,
+            int(time.time()),
+            rng.randint(-85, -45),
+            altitude,
+            self.seq,
+            dht_temp,
+            dht_rh,
+            self.temp,
+            self.press,
+        )
+
+    def bad_payload(self, kind: str, rng: random.Random) -> bytes:
+        good = self.payload(rng)
+        if kind == "truncated":
+            return good[: rng.randint(1, len(good) - 1)].encode()
+        if kind == "garbage":
+            return bytes(rng.getrandbits(8) for _ in range(rng.randint(1, 64)))
+        if kind == "non_object":
+            return b"[1, 2, 3]"
+        # wrong_types: valid JSON, sensor values as strings
+        data = json.loads(good)
+        data["dht22"]["temperature_c"] = "nan"
+        data["bmp280"]["pressure_pa"] = "err"
+        return json.dumps(data, separators=(",", ":")).encode()
+
+
+class Publisher:
+    """Nodes spread over a few MQTT connections, paced from one scheduler thread."""
+
+    def __init__(self, args, nodes):
+        self.args = args
+        self.nodes = nodes
+        self.rng = random.Random(args.seed)
+        self.sent = {}  # (device_id, seq) -> monotonic publish time
+        self.pending = deque()  # (wall clock second, key) of good messages, in publish order
+        self.bad_sent = defaultdict(int)
+        self.bad_keys = {}  # (device_id, seq) -> kind, for bad payloads that could be stored
+        self.lag_ms = []
+        self.acked = 0
+        self.lock = threading.Lock()
+
+        self.clients = []
+        for i in range(min(args.connections, len(nodes))):
+            client = mqtt.Client(
+                mqtt.CallbackAPIVersion.VERSION2, client_id=f"fleet-sim-{os.getpid()}-{i}"
+            )
+            if args.username:
+                client.username_pw_set(args.username, args.password)
+            client.max_queued_messages_set(0)
+            client.max_inflight_messages_set(1000)
+            client.on_publish = self.on_publish
+            client.connect(args.broker, args.port, keepalive=60)
+            client.loop_start()
+            self.clients.append(client)
+
+    def on_publish(self, client, userdata, mid, reason_code, properties):
+        with self.lock:
+            self.acked += 1
+
+    def publish(self, index: int) -> None:
+        node = self.nodes[index]
+        client = self.clients[index % len(self.clients)]
+        if self.rng.random() < self.args.bad_ratio:
+            kind = self.rng.choice(BAD_KINDS)
+            payload = node.bad_payload(kind, self.rng)
+            self.bad_sent[kind] += 1
+            self.bad_keys[(node.device_id, node.seq)] = kind
+        else:
+            payload = node.payload(self.rng)
+            key = (node.device_id, node.seq)
+            self.sent[key] = time.monotonic()
+            self.pending.append((int(time.time()), key))
+        client.publish(node.topic, payload, qos=self.args.qos)
+
+    def next_interval(self) -> float:
+        jitter = self.args.jitter
+        return self.args.interval * (1 + self.rng.uniform(-jitter, jitter))
+
+    def run(self, deadline: float) -> None:
+        now = time.monotonic()
+        # Nodes boot spread over one interval, like a real fleet.
+        events = [(now + self.rng.uniform(0, self.args.interval), i) for i in range(len(self.nodes))]
+        if self.args.burst_every:
+            events.append((now + self.args.burst_every, -1))
+        heapq.heapify(events)
+
+        while events:
+            due, index = heapq.heappop(events)
+            if due >= deadline:
+                break
+            delay = due - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            else:
+                self.lag_ms.append(-delay * 1000)
+
+            if index == -1:
+                # Every node flushes a backlog at once, as after a broker or
+                # Wi-Fi outage.
+                for _ in range(self.args.burst_size):
+                    for i in range(len(self.nodes)):
+                        self.publish(i)
+                heapq.heappush(events, (due + self.args.burst_every, -1))
+            else:
+                self.publish(index)
+                heapq.heappush(events, (due + self.next_interval(), index))
+
+    def close(self) -> None:
+        for client in self.clients:
+            client.loop_stop()
+            client.disconnect()
+
+
+class RowWatcher(threading.Thread):
+    """
+    Polls the ingest database for new rows and timestamps their arrival.
+
+    Rows commit in id order, but a batching writer may commit a row with an
+    older timestamp_server after a newer one. So each poll reads rows above
+    the highest id seen, starting from the publish second of the oldest
+    message still missing (a row is never stamped before its publish).
+    """
+
+    def __init__(self, db_path: str, prefix: str, poll: float, publisher: Publisher):
+        super().__init__(daemon=True)
+        self.conn = sqlite3.connect(f"file:{quote(os.path.abspath(db_path))}?mode=ro", uri=True, check_same_thread=False)
+        self.prefix = prefix
+        self.poll = poll
+        self.publisher = publisher
+        self.seen = {}  # (device_id, free_heap) -> monotonic time first seen
+        self.stop = threading.Event()
+        (self.last_id,) = self.conn.execute("SELECT COALESCE(MAX(value), 0) FROM id_sequence").fetchone()
+
+    def run(self) -> None:
+        query = """
+            SELECT id, device_id, free_heap
+            FROM measurements
+            WHERE timestamp_server >= ? AND id > ?
+        """
+        pending = self.publisher.pending
+        while not self.stop.is_set():
+            while pending and pending[0][1] in self.seen:
+                pending.popleft()
+            since = pending[0][0] - 1 if pending else int(time.time()) - 1
+
+            rows = self.conn.execute(query, (since, self.last_id)).fetchall()
+            now = time.monotonic()
+            for row_id, device_id, seq in rows:
+                if device_id.startswith(self.prefix):
+                    self.seen.setdefault((device_id, seq), now)
+                self.last_id = max(self.last_id, row_id)
+            time.sleep(self.poll)
+
+
+def run_api_clients(args, deadline):
+    latencies = defaultdict(list)
+    errors = defaultdict(int)
+    lock = threading.Lock()
+    threads = [
+        threading.Thread(target=client_loop, args=(args.api, deadline, latencies, errors, lock), daemon=True)
+        for _ in range(args.api_clients)
+    ]
+    for t in threads:
+        t.start()
+    return threads, latencies, errors
+
+
+def ms(values, pct):
+    # JSON has no NaN; an empty series is reported as null.
+    return round(percentile(values, pct), 2) if values else None
+
+
+def summarize(args, publisher, watcher, elapsed, api_latencies, api_errors):
+    latencies = []
+    first_seen, last_seen = None, None
+    for key, sent_at in publisher.sent.items():
+        seen_at = watcher.seen.get(key)
+        if seen_at is None:
+            continue
+        latencies.append((seen_at - sent_at) * 1000)
+        first_seen = seen_at if first_seen is None else min(first_seen, seen_at)
+        last_seen = seen_at if last_seen is None else max(last_seen, seen_at)
+
+    stored = len(latencies)
+    bad_stored = defaultdict(int)
+    for key, kind in publisher.bad_keys.items():
+        if key in watcher.seen:
+            bad_stored[kind] += 1
+
+    return {
+        "config": {
+            k: getattr(args, k)
+            for k in ("nodes", "interval", "jitter", "burst_every", "burst_size", "bad_ratio", "qos", "connections", "duration", "api_clients")
+        },
+        "publish": {
+            "messages": len(publisher.sent) + sum(publisher.bad_sent.values()),
+            "good": len(publisher.sent),
+            "acked": publisher.acked,
+            "rate_per_s": round((len(publisher.sent) + sum(publisher.bad_sent.values())) / elapsed, 1),
+            "scheduler_lag_p99_ms": ms(publisher.lag_ms, 99) or 0.0,
+        },
+        "ingest": {
+            "stored": stored,
+            "dropped": len(publisher.sent) - stored,
+            "rows_per_s": round(stored / (last_seen - first_seen), 1) if stored > 1 and last_seen > first_seen else None,
+            "latency_ms": {
+                "p50": ms(latencies, 50),
+                "p90": ms(latencies, 90),
+                "p99": ms(latencies, 99),
+                "max": round(max(latencies), 2) if latencies else None,
+            },
+        },
+        "bad_payloads": {
+            kind: {"sent": publisher.bad_sent[kind], "stored": bad_stored[kind]} for kind in BAD_KINDS
+        },
+        "api": {
+            endpoint: {
+                "requests": len(values),
+                "errors": api_errors[endpoint],
+                "p50_ms": ms(values, 50),
+                "p99_ms": ms(values, 99),
+            }
+            for endpoint, values in sorted(api_latencies.items())
+        },
+    }
+
+
+def compare(result, baseline, tolerance):
+    """Regressions beyond `tolerance` (a fraction) against a saved result."""
+    checks = [
+        ("ingest.rows_per_s", result["ingest"]["rows_per_s"], baseline["ingest"]["rows_per_s"], True),
+        ("ingest.latency_ms.p99", result["ingest"]["latency_ms"]["p99"], baseline["ingest"]["latency_ms"]["p99"], False),
+        ("ingest.dropped", result["ingest"]["dropped"], baseline["ingest"]["dropped"], False),
+    ]
+    for endpoint, values in baseline["api"].items():
+        if endpoint in result["api"]:
+            checks.append((f"api.{endpoint}.p99_ms", result["api"][endpoint]["p99_ms"], values["p99_ms"], False))
+
+    regressions = []
+    for name, current, previous, higher_is_better in checks:
+        if current is None or previous is None:
+            continue
+        if higher_is_better:
+            worse = current < previous * (1 - tolerance)
+        else:
+            # Small absolute counts (drops) must not flag on noise alone.
+            worse = current > previous * (1 + tolerance) and current - previous > 1
+        if worse:
+            regressions.append(f"{name}: {previous} -> {current}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fleet simulator and end-to-end load benchmark")
+    parser.add_argument("--broker", default=os.getenv("MQTT_BROKER", "localhost"))
+    parser.add_argument("--port", type=int, default=int(os.getenv("MQTT_PORT", "1883")))
+    parser.add_argument("--username", default=os.getenv("MQTT_USERNAME"))
+    parser.add_argument("--password", default=os.getenv("MQTT_PASSWORD"))
+    parser.add_argument("--db", required=True, help="database main.py writes to")
+    parser.add_argument("--nodes", type=int, default=50)
+    parser.add_argument("--interval", type=float, default=10, help="seconds between messages per node")
+    parser.add_argument("--jitter", type=float, default=0.1, help="+/- fraction of the interval")
+    parser.add_argument("--burst-every", type=float, default=0, help="seconds between fleet-wide bursts (0: none)")
+    parser.add_argument("--burst-size", type=int, default=5, help="messages per node in a burst")
+    parser.add_argument("--bad-ratio", type=float, default=0.01, help="fraction of malformed payloads")
+    parser.add_argument("--qos", type=int, default=1, choices=[0, 1])
+    parser.add_argument("--connections", type=int, default=8, help="MQTT connections shared by the nodes")
+    parser.add_argument("--duration", type=float, default=60, help="seconds of publishing")
+    parser.add_argument("--drain", type=float, default=10, help="seconds to wait for stragglers")
+    parser.add_argument("--prefix", default="sim-node", help="device id prefix")
+    parser.add_argument("--fw", default="sim-1.0.0")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--api", help="web_server.py base URL; replays the dashboard when set")
+    parser.add_argument("--api-clients", type=int, default=4)
+    parser.add_argument("--poll", type=float, default=0.01, help="database poll interval, seconds")
+    parser.add_argument("--output", help="write the results JSON here")
+    parser.add_argument("--baseline", help="results JSON of an earlier run to compare against")
+    parser.add_argument("--tolerance", type=float, default=0.2)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    nodes = [Node(i, args.prefix, args.fw, rng) for i in range(args.nodes)]
+    publisher = Publisher(args, nodes)
+    watcher = RowWatcher(args.db, args.prefix, args.poll, publisher)
+    watcher.start()
+
+    t0 = time.monotonic()
+    deadline = t0 + args.duration
+    api_threads, api_latencies, api_errors = ([], {}, {})
+    if args.api:
+        api_threads, api_latencies, api_errors = run_api_clients(args, deadline)
+
+    publisher.run(deadline)
+    elapsed = time.monotonic() - t0
+
+    # Wait until every good message is stored or nothing new arrives for --drain seconds.
+    last_progress, last_count = time.monotonic(), -1
+    while time.monotonic() - last_progress < args.drain:
+        count = sum(1 for key in publisher.sent if key in watcher.seen)
+        if count == len(publisher.sent):
+            break
+        if count != last_count:
+            last_progress, last_count = time.monotonic(), count
+        time.sleep(0.2)
+
+    for t in api_threads:
+        t.join()
+    watcher.stop.set()
+    watcher.join()
+    publisher.close()
+
+    result = summarize(args, publisher, watcher, elapsed, api_latencies, api_errors)
+    text = json.dumps(result, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    print(text)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(result, json.load(f), args.tolerance)
+        for line in regressions:
+            print(f"REGRESSION {line}", file=sys.stderr)
+        sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
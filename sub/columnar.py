@@ -0,0 +1,78 @@
+from itertools import accumulate
+from operator import sub
+from typing import Any, Dict, List, Optional, Sequence
+
+from export import COLUMN_TYPES
+
+# ----------------------------
+# Columnar JSON responses
+# ----------------------------
+#
+# format=columnar returns one array per column instead of one object per
+# row, so column names are sent once and no dict is built per row: rows come
+# from the cursor as tuples and are transposed by zip() in C.
+#
+# With delta=true, integer columns without NULLs (ids, timestamps) are sent
+# as their first value followed by the difference to the previous value,
+# which turns ten-digit timestamps into one or two digits. Decoding is a
+# running sum; the columns this applies to are listed in "delta".
+
+
+def delta_encode(values: Sequence[int]) -> List[int]:
+    if not values:
+        return []
+    return [values[0], *map(sub, values[1:], values[:-1])]
+
+
+def delta_decode(values: Sequence[int]) -> List[int]:
+    return list(accumulate(values))
+
+
+def can_delta(name: str, values: Sequence[Any]) -> bool:
+    return COLUMN_TYPES.get(name) == "int64" and None not in values
+
+
+def columns_from_cursor(cursor, delta: bool = False) -> Dict[str, Any]:
+    """Read a cursor into {"columns": {name: [values]}, "count", "delta"}."""
+    names = [d[0] for d in cursor.description]
+    cursor.row_factory = None
+    return columns_from_rows(names, cursor.fetchall(), delta)
+
+
+def columns_from_rows(names: Sequence[str], rows: Sequence[tuple], delta: bool = False) -> Dict[str, Any]:
+    """Same as columns_from_cursor for rows already fetched as tuples."""
+    values = [list(column) for column in zip(*rows)] if rows else [[] for _ in names]
+
+    columns: Dict[str, List[Any]] = dict(zip(names, values))
+    encoded: List[str] = []
+    if delta:
+        for name in names:
+            if can_delta(name, columns[name]):
+                columns[name] = delta_encode(columns[name])
+                encoded.append(name)
+
+    return {"format": "columnar", "columns": columns, "count": len(rows), "delta": encoded}
+
+
+def columnar_series(
+    series: Dict[str, Dict[str, List[Sequence]]], delta: bool = False
+) -> Dict[str, Dict[str, Dict[str, List]]]:
+    """Turn {device: {field: [(t, v), ...]}} into {device: {field: {"t": [...], "v": [...]}}}."""
+    out: Dict[str, Dict[str, Dict[str, List]]] = {}
+    for device_id, fields in series.items():
+        out[device_id] = {}
+        for field, points in fields.items():
+            ts, vs = (list(c) for c in zip(*points)) if points else ([], [])
+            out[device_id][field] = {"t": delta_encode(ts) if delta else ts, "v": vs}
+    return out
+
+
+def selected_columns(fields: Optional[str], allowed: Sequence[str]) -> Optional[List[str]]:
+    """Validate a comma separated field list; None selects every column."""
+    if not fields:
+        return None
+    selected = fields.split(",")
+    unknown = [f for f in selected if f not in allowed]
+    if unknown:
+        raise ValueError(f"Unknown fields: {', '.join(unknown)}")
+    return selected
@@ -0,0 +1,228 @@
+import asyncio
+import queue
+import sqlite3
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+from concurrent.futures import TimeoutError as FutureTimeout
+from pathlib import Path
+from typing import Any, AsyncIterator, Callable, List, Optional, Sequence
+from urllib.parse import quote
+
+# ----------------------------
+# Read-only SQLite connection pool
+# ----------------------------
+
+# Number of SQLite VM instructions between progress handler calls. Small
+# enough to notice a deadline within a few milliseconds, large enough that the
+# callback itself does not show up in profiles.
+PROGRESS_STEPS = 10000
+
+# End-of-stream marker passed from a stream's worker thread.
+_DONE = object()
+
+
+class QueryTimeout(Exception):
+    """Raised when a query exceeds its time budget and was interrupted."""
+
+
+class ReadPool:
+    """
+    Fixed-size pool of read-only SQLite connections served from a dedicated
+    thread pool, so blocking queries never run on the asyncio event loop.
+
+    Connections are opened lazily in URI read-only mode with memory-mapped
+    I/O enabled, and are reused across requests so sqlite3's per-connection
+    prepared statement cache stays warm.
+
+    If set, on_query(seconds) is called on the event loop with the time each
+    query spent on its connection, excluding the wait for a free thread.
+    """
+
+    def __init__(
+        self,
+        path: str,
+        size: int = 4,
+        mmap_size: int = 64 * 1024 * 1024,
+        cached_statements: int = 256,
+        timeout: float = 5.0,
+        on_query: Optional[Callable[[float], None]] = None,
+    ):
+        self.path = path
+        self.size = size
+        self.mmap_size = mmap_size
+        self.cached_statements = cached_statements
+        self.timeout = timeout
+        self.on_query = on_query
+
+        self._idle: "queue.LifoQueue[sqlite3.Connection]" = queue.LifoQueue()
+        self._executor = ThreadPoolExecutor(max_workers=size, thread_name_prefix="sqlite-ro")
+
+    def _connect(self) -> sqlite3.Connection:
+        uri = f"file:{quote(str(Path(self.path).resolve()))}?mode=ro"
+        conn = sqlite3.connect(
+            uri,
+            uri=True,
+            check_same_thread=False,
+            cached_statements=self.cached_statements,
+        )
+        conn.row_factory = sqlite3.Row
+        conn.execute(f"PRAGMA mmap_size = {int(self.mmap_size)}")
+        conn.execute("PRAGMA query_only = 1")
+        return conn
+
+    def _acquire(self) -> sqlite3.Connection:
+        # Only executor threads call this, and there are never more of them
+        # than pool slots, so an empty queue means a connection still has to
+        # be opened rather than that all of them are busy.
+        try:
+            return self._idle.get_nowait()
+        except queue.Empty:
+            return self._connect()
+
+    def _release(self, conn: sqlite3.Connection) -> None:
+        self._idle.put(conn)
+
+    def _run(
+        self, fn: Callable[[sqlite3.Connection], Any], timeout: Optional[float], elapsed: List[float]
+    ) -> Any:
+        conn = self._acquire()
+        deadline = time.monotonic() + timeout if timeout else None
+
+        if deadline is not None:
+            conn.set_progress_handler(lambda: time.monotonic() > deadline, PROGRESS_STEPS)
+        started = time.perf_counter()
+        try:
+            return fn(conn)
+        except sqlite3.OperationalError as e:
+            if deadline is not None and time.monotonic() > deadline and "interrupt" in str(e):
+                raise QueryTimeout(f"Query exceeded {timeout:.1f}s time limit") from e
+            raise
+        finally:
+            elapsed.append(time.perf_counter() - started)
+            if deadline is not None:
+                conn.set_progress_handler(None, 0)
+            # Never hand back a connection that is still inside a read
+            # transaction, it would pin an old snapshot.
+            if conn.in_transaction:
+                conn.rollback()
+            self._release(conn)
+
+    async def run(
+        self, fn: Callable[[sqlite3.Connection], Any], timeout: Optional[float] = None
+    ) -> Any:
+        """Run fn(conn) on a pooled connection in the pool's worker threads."""
+        loop = asyncio.get_running_loop()
+        budget = self.timeout if timeout is None else timeout
+        elapsed: List[float] = []
+        try:
+            return await loop.run_in_executor(self._executor, self._run, fn, budget, elapsed)
+        finally:
+            if self.on_query and elapsed:
+                self.on_query(elapsed[0])
+
+    async def fetchall(
+        self, query: str, params: Sequence[Any] = (), timeout: Optional[float] = None
+    ) -> List[sqlite3.Row]:
+        return await self.run(lambda conn: conn.execute(query, params).fetchall(), timeout)
+
+    async def fetchone(
+        self, query: str, params: Sequence[Any] = (), timeout: Optional[float] = None
+    ) -> Optional[sqlite3.Row]:
+        return await self.run(lambda conn: conn.execute(query, params).fetchone(), timeout)
+
+    async def stream(
+        self,
+        query: str,
+        params: Sequence[Any] = (),
+        timeout: Optional[float] = None,
+        batch_size: int = 500,
+    ) -> AsyncIterator[Any]:
+        """
+        Run a query on its own connection and thread, yielding the column
+        names first and then lists of row tuples. A timeout of 0 disables
+        the time limit.
+
+        A single statement reads from one snapshot of the database, so the
+        rows are consistent even while ingest keeps writing.
+
+        At most two batches are buffered ahead of the consumer, so memory
+        stays constant however many rows the query produces. Closing the
+        generator early interrupts the statement.
+        """
+        loop = asyncio.get_running_loop()
+        budget = self.timeout if timeout is None else timeout
+        batches: asyncio.Queue = asyncio.Queue(maxsize=2)
+        stop = threading.Event()
+        # Time spent in SQLite, not waiting for the consumer.
+        elapsed = [0.0]
+
+        def put(item: Any) -> None:
+            # Blocks the worker while the consumer is behind (backpressure).
+            future = asyncio.run_coroutine_threadsafe(batches.put(item), loop)
+            while not stop.is_set():
+                try:
+                    future.result(timeout=1)
+                    return
+                except FutureTimeout:
+                    continue
+            future.cancel()
+
+        def worker() -> None:
+            try:
+                conn = self._connect()
+            except sqlite3.Error as e:
+                put(e)
+                return
+
+            deadline = time.monotonic() + budget if budget else float("inf")
+            conn.set_progress_handler(
+                lambda: stop.is_set() or time.monotonic() > deadline, PROGRESS_STEPS
+            )
+            try:
+                started = time.perf_counter()
+                cursor = conn.execute(query, params)
+                cursor.row_factory = None
+                elapsed[0] += time.perf_counter() - started
+                put([d[0] for d in cursor.description or ()])
+                while not stop.is_set():
+                    started = time.perf_counter()
+                    batch = cursor.fetchmany(batch_size)
+                    elapsed[0] += time.perf_counter() - started
+                    if not batch:
+                        break
+                    put(batch)
+                put(_DONE)
+            except sqlite3.OperationalError as e:
+                if time.monotonic() > deadline and "interrupt" in str(e):
+                    put(QueryTimeout(f"Query exceeded {budget:.1f}s time limit"))
+                else:
+                    put(e)
+            except sqlite3.Error as e:
+                put(e)
+            finally:
+                conn.close()
+
+        threading.Thread(target=worker, name="sqlite-stream", daemon=True).start()
+        try:
+            while True:
+                item = await batches.get()
+                if item is _DONE:
+                    return
+                if isinstance(item, Exception):
+                    raise item
+                yield item
+        finally:
+            stop.set()
+            while not batches.empty():
+                batches.get_nowait()
+            if self.on_query:
+                self.on_query(elapsed[0])
+
+    def close(self) -> None:
+        self._executor.shutdown(wait=True)
+        while True:
+            try:
+                self._idle.get_nowait().close()
+            except queue.Empty:
+                break
@@ -0,0 +1,273 @@
+import argparse
+import json
+import logging
+import math
+import os
+import sqlite3
+import time
+from collections import deque
+from itertools import islice
+from typing import Any, Deque, Dict, Iterable, Optional, Tuple
+
+from dotenv import load_dotenv
+
+from quality import FIELD_BITS, is_number
+
+# ----------------------------
+# Derived meteorological fields at ingest
+# ----------------------------
+#
+# Computed once per measurement in the writer, next to the quality flags, and
+# stored with the row so readers never recompute them:
+#
+#   dew_point_c               Magnus formula over the DHT22 temperature and
+#                             humidity (Alduchov & Eskridge 1996 constants)
+#   absolute_humidity_gm3     water vapour density in g/m3, same inputs
+#   pressure_qnh_pa           BMP280 station pressure reduced to sea level with
+#                             the ICAO standard atmosphere for the device's
+#                             configured elevation (STATION_ELEVATIONS)
+#   pressure_tendency_pa_3h   station pressure change over the last 3 hours
+#
+# A field is NULL when an input is missing or flagged by quality.py, when the
+# device has no configured elevation (QNH), or when there is no reading
+# between TENDENCY_MIN_AGE and TENDENCY_MAX_AGE old to compare with (tendency).
+# The firmware's altitude_m is computed against a fixed 101325 Pa and is not
+# used for any of them.
+
+DERIVED_FIELDS = (
+    "dew_point_c",
+    "absolute_humidity_gm3",
+    "pressure_qnh_pa",
+    "pressure_tendency_pa_3h",
+)
+
+MAGNUS_A = 17.625
+MAGNUS_B = 243.04  # degC
+SATURATION_PA_0C = 610.94
+WATER_VAPOUR_GAS_CONSTANT = 461.5  # J/(kg K)
+
+# ICAO standard atmosphere
+ISA_LAPSE_RATE = 0.0065  # K/m
+ISA_SEA_LEVEL_K = 288.15
+ISA_EXPONENT = 5.25588
+
+TENDENCY_SECONDS = 3 * 3600
+# The reading compared with is the one closest to 3 hours old, within
+# half an hour either way; the change is scaled to exactly 3 hours.
+TENDENCY_MIN_AGE = TENDENCY_SECONDS - 1800
+TENDENCY_MAX_AGE = TENDENCY_SECONDS + 1800
+
+TEMPERATURE = "dht22_temperature_c"
+HUMIDITY = "dht22_humidity_percent"
+PRESSURE = "bmp280_pressure_pa"
+INPUT_FIELDS = (TEMPERATURE, HUMIDITY, PRESSURE)
+
+
+def dew_point(temperature_c: float, humidity_percent: float) -> Optional[float]:
+    if humidity_percent <= 0:
+        return None
+    gamma = math.log(humidity_percent / 100) + MAGNUS_A * temperature_c / (MAGNUS_B + temperature_c)
+    return MAGNUS_B * gamma / (MAGNUS_A - gamma)
+
+
+def absolute_humidity(temperature_c: float, humidity_percent: float) -> float:
+    saturation = SATURATION_PA_0C * math.exp(MAGNUS_A * temperature_c / (MAGNUS_B + temperature_c))
+    vapour = saturation * humidity_percent / 100
+    return vapour / (WATER_VAPOUR_GAS_CONSTANT * (temperature_c + 273.15)) * 1000
+
+
+def qnh(pressure_pa: float, elevation_m: float) -> float:
+    return pressure_pa * (1 - ISA_LAPSE_RATE * elevation_m / ISA_SEA_LEVEL_K) ** -ISA_EXPONENT
+
+
+def load_elevations(path: str) -> Dict[str, float]:
+    """Read {"device_id": elevation in metres, ...} from a JSON file."""
+    with open(path) as f:
+        elevations = json.load(f)
+    if not isinstance(elevations, dict) or not all(is_number(v) for v in elevations.values()):
+        raise ValueError(f"{path}: expected an object of device_id -> elevation in metres")
+    return {device_id: float(v) for device_id, v in elevations.items()}
+
+
+class DerivedFields:
+    """
+    Fills DERIVED_FIELDS of measurements fed in arrival order. Holds each
+    device's last 3.5 hours of good pressure readings for the tendency.
+    """
+
+    def __init__(self, elevations: Optional[Dict[str, float]] = None):
+        self.elevations = elevations or {}
+        self.pressure: Dict[str, Deque[Tuple[int, float]]] = {}
+
+    def _good(self, measurement: Dict[str, Any], field: str) -> Optional[float]:
+        value = measurement.get(field)
+        if not is_number(value) or measurement.get("quality", 0) & FIELD_BITS[field]:
+            return None
+        return value
+
+    def compute(self, measurement: Dict[str, Any]) -> Dict[str, Optional[float]]:
+        """Derived fields of a quality-checked measurement; remembers its pressure."""
+        derived: Dict[str, Optional[float]] = dict.fromkeys(DERIVED_FIELDS)
+        device_id = measurement["device_id"]
+
+        temperature = self._good(measurement, TEMPERATURE)
+        humidity = self._good(measurement, HUMIDITY)
+        if temperature is not None and humidity is not None:
+            dew = dew_point(temperature, humidity)
+            derived["dew_point_c"] = None if dew is None else round(dew, 2)
+            derived["absolute_humidity_gm3"] = round(absolute_humidity(temperature, humidity), 2)
+
+        pressure = self._good(measurement, PRESSURE)
+        if pressure is not None:
+            elevation = self.elevations.get(device_id)
+            if elevation is not None:
+                derived["pressure_qnh_pa"] = round(qnh(pressure, elevation), 1)
+            tendency = self._tendency(device_id, measurement["timestamp_server"], pressure)
+            if tendency is not None:
+                derived["pressure_tendency_pa_3h"] = round(tendency, 1)
+
+        return derived
+
+    def fill(self, measurement: Dict[str, Any]) -> None:
+        measurement.update(self.compute(measurement))
+
+    def _tendency(self, device_id: str, now: int, pressure: float) -> Optional[float]:
+        recent = self.pressure.get(device_id)
+        if recent is None:
+            recent = self.pressure[device_id] = deque()
+        target = now - TENDENCY_SECONDS
+        # Keep the last reading at or before the target and everything after
+        # it: the closest reading to the target is then recent[0] or recent[1].
+        while len(recent) > 1 and recent[1][0] <= target:
+            recent.popleft()
+
+        best = None
+        best_diff = float("inf")
+        for ts, value in islice(recent, 2):
+            age = now - ts
+            if TENDENCY_MIN_AGE <= age <= TENDENCY_MAX_AGE and abs(age - TENDENCY_SECONDS) < best_diff:
+                best = (age, value)
+                best_diff = abs(age - TENDENCY_SECONDS)
+
+        # Readings arriving out of order (same or older timestamp) are not
+        # kept, so the deque stays sorted.
+        if not recent or now > recent[-1][0]:
+            recent.append((now, pressure))
+        if best is None:
+            return None
+        age, value = best
+        return (pressure - value) * TENDENCY_SECONDS / age
+
+    def warm(self, conn: sqlite3.Connection) -> None:
+        """Fill the pressure windows from the stored rows, e.g. after a restart."""
+        since = int(time.time()) - TENDENCY_MAX_AGE
+        for device_id, ts, value in conn.execute(
+            f"""
+            SELECT device_id, timestamp_server, {PRESSURE}
+            FROM measurements
+            WHERE device_id IN (SELECT device_id FROM device_state)
+              AND timestamp_server >= ?
+              AND {PRESSURE} IS NOT NULL AND quality & {FIELD_BITS[PRESSURE]} = 0
+            ORDER BY device_id, timestamp_server, id
+            """,
+            (since,),
+        ):
+            self._tendency(device_id, ts, value)
+
+
+# ----------------------------
+# Backfill of stored rows
+# ----------------------------
+#
+# Rows stored before these columns existed, or before a device's elevation
+# was configured, have NULLs. This replays each device's history in time
+# order and writes the derived fields in short transactions, so ingest can
+# keep running. Run it after quality.py's backfill, as flagged inputs are
+# skipped. Rerun after changing STATION_ELEVATIONS.
+
+load_dotenv()
+
+SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+STATION_ELEVATIONS = os.getenv("STATION_ELEVATIONS", "")
+
+
+def device_rows(conn: sqlite3.Connection, device_id: str, batch_size: int) -> Iterable[list]:
+    columns = ", ".join(INPUT_FIELDS)
+    last = (-1, -1)
+    while True:
+        batch = conn.execute(
+            f"""
+            SELECT timestamp_server, id, quality, {columns}
+            FROM measurements
+            WHERE device_id = ? AND (timestamp_server, id) > (?, ?)
+            ORDER BY timestamp_server, id
+            LIMIT ?
+            """,
+            (device_id, *last, batch_size),
+        ).fetchall()
+        if not batch:
+            return
+        yield batch
+        last = batch[-1][:2]
+
+
+def backfill(conn: sqlite3.Connection, elevations: Dict[str, float], batch_size: int, pause: float) -> int:
+    assignments = ", ".join(f"{f} = ?" for f in DERIVED_FIELDS)
+    devices = [row[0] for row in conn.execute("SELECT device_id FROM device_state")]
+    total = 0
+    for device_id in devices:
+        derived = DerivedFields(elevations)
+        for batch in device_rows(conn, device_id, batch_size):
+            updates = []
+            for ts, row_id, quality, *values in batch:
+                measurement = {
+                    "device_id": device_id,
+                    "timestamp_server": ts,
+                    "quality": quality,
+                    **dict(zip(INPUT_FIELDS, values)),
+                }
+                row = derived.compute(measurement)
+                updates.append((*(row[f] for f in DERIVED_FIELDS), device_id, ts, row_id))
+            conn.executemany(
+                f"""
+                UPDATE measurements SET {assignments}
+                WHERE device_id = ? AND timestamp_server = ? AND id = ?
+                """,
+                updates,
+            )
+            conn.commit()
+            total += len(updates)
+            time.sleep(pause)
+        logging.info(f"Updated {device_id}, {total} rows so far")
+    return total
+
+
+def main():
+    from storage import init_db
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
+
+    parser = argparse.ArgumentParser(description="Compute derived fields for stored measurements")
+    parser.add_argument("--db", default=SQLITE_DB, help="SQLite database (default: $SQLITE_DB)")
+    parser.add_argument(
+        "--elevations",
+        default=STATION_ELEVATIONS,
+        help="JSON file of station elevations (default: $STATION_ELEVATIONS)",
+    )
+    parser.add_argument("--batch-size", type=int, default=5000, help="rows per transaction")
+    parser.add_argument("--pause", type=float, default=0.01, help="seconds between batches")
+    args = parser.parse_args()
+
+    elevations = load_elevations(args.elevations) if args.elevations else {}
+
+    conn = sqlite3.connect(args.db, timeout=60)
+    init_db(conn)
+
+    t0 = time.perf_counter()
+    total = backfill(conn, elevations, args.batch_size, args.pause)
+    conn.close()
+    logging.info(f"Derived fields for {total} rows in {time.perf_counter() - t0:.1f}s")
+
+
+if __name__ == "__main__":
+    main()
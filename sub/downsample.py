@@ -0,0 +1,145 @@
+from collections import deque
+from itertools import groupby
+from operator import itemgetter
+from typing import Dict, List, Optional, Sequence, Tuple
+
+# ----------------------------
+# Outlier rejection and downsampling for chart series
+# ----------------------------
+
+Point = Tuple[int, float]
+
+# Plausible absolute ranges per field, same limits the dashboard used.
+VALID_RANGES = {
+    "dht22_temperature_c": (-10, 50),
+    "bmp280_temperature_c": (-10, 50),
+    "dht22_humidity_percent": (0, 100),
+    "bmp280_pressure_pa": (80000, 110000),
+    "altitude_m": (-500, 5000),
+    "free_heap": (0, 400000),
+    "rssi": (-100, 0),
+    # Derived at ingest (derived.py)
+    "dew_point_c": (-40, 50),
+    "absolute_humidity_gm3": (0, 100),
+    "pressure_qnh_pa": (87000, 109000),
+    "pressure_tendency_pa_3h": (-2000, 2000),
+}
+
+# Maximum allowed deviation from the moving average of accepted points.
+MAX_DEVIATION = {
+    "dht22_temperature_c": 5,
+    "bmp280_temperature_c": 5,
+    "dht22_humidity_percent": 15,
+    "bmp280_pressure_pa": 2000,
+    "altitude_m": 200,
+    "free_heap": 50000,
+    "rssi": 20,
+    "dew_point_c": 5,
+    "absolute_humidity_gm3": 5,
+    "pressure_qnh_pa": 2000,
+    "pressure_tendency_pa_3h": 300,
+}
+
+SERIES_FIELDS = tuple(VALID_RANGES)
+
+
+def filter_outliers(
+    ts: Sequence[int], values: Sequence[Optional[float]], field: str, window: int = 5
+) -> Tuple[List[int], List[float]]:
+    """
+    Single-pass moving-average outlier rejection for one series.
+
+    A value is dropped when it is outside the field's absolute range, or
+    when it deviates more than MAX_DEVIATION from the mean of the last
+    `window` accepted values. The first `window` samples are only range
+    checked, there is no history to compare them with yet.
+    """
+    low, high = VALID_RANGES.get(field, (float("-inf"), float("inf")))
+    max_deviation = MAX_DEVIATION.get(field)
+
+    recent: deque = deque(maxlen=window)
+    recent_sum = 0.0
+    out_t: List[int] = []
+    out_v: List[float] = []
+
+    for index, (t, value) in enumerate(zip(ts, values)):
+        if value is None or value < low or value > high:
+            continue
+
+        if max_deviation is not None and index >= window and recent:
+            if abs(value - recent_sum / len(recent)) > max_deviation:
+                continue
+
+        if len(recent) == window:
+            recent_sum -= recent[0]
+        recent.append(value)
+        recent_sum += value
+        out_t.append(t)
+        out_v.append(value)
+
+    return out_t, out_v
+
+
+def lttb(ts: Sequence[int], values: Sequence[float], threshold: int) -> List[Point]:
+    """
+    Largest-Triangle-Three-Buckets downsampling (Steinarsson, 2013).
+
+    Keeps the first and last point and, from each of threshold - 2 equal
+    sized buckets in between, the point forming the largest triangle with
+    the previously kept point and the average of the next bucket.
+    """
+    n = len(ts)
+    if threshold >= n or threshold < 3:
+        return list(zip(ts, values))
+
+    sampled = [(ts[0], values[0])]
+    bucket_size = (n - 2) / (threshold - 2)
+    a = 0
+
+    for i in range(threshold - 2):
+        # Average of the next bucket is the third triangle vertex.
+        next_start = int((i + 1) * bucket_size) + 1
+        next_end = min(int((i + 2) * bucket_size) + 1, n)
+        count = next_end - next_start
+        avg_t = sum(ts[next_start:next_end]) / count
+        avg_v = sum(values[next_start:next_end]) / count
+
+        start = int(i * bucket_size) + 1
+        end = int((i + 1) * bucket_size) + 1
+        at, av = ts[a], values[a]
+        dt, dv = at - avg_t, avg_v - av
+
+        best_area = -1.0
+        best = start
+        for j in range(start, end):
+            area = abs(dt * (values[j] - av) - (at - ts[j]) * dv)
+            if area > best_area:
+                best_area = area
+                best = j
+
+        sampled.append((ts[best], values[best]))
+        a = best
+
+    sampled.append((ts[-1], values[-1]))
+    return sampled
+
+
+def downsample_rows(
+    rows, fields: Sequence[str], threshold: int
+) -> Dict[str, Dict[str, List[Point]]]:
+    """
+    Build filtered, downsampled series from rows of
+    (device_id, timestamp_server, *fields) ordered by device then time.
+    """
+    series: Dict[str, Dict[str, List[Point]]] = {}
+
+    for device_id, device_rows in groupby(rows, key=itemgetter(0)):
+        # Transpose once in C instead of touching every cell from Python.
+        columns = list(zip(*device_rows))
+        ts = columns[1]
+        series[device_id] = {
+            field: lttb(*filter_outliers(ts, columns[offset], field), threshold)
+            for offset, field in enumerate(fields, start=2)
+        }
+
+    return series
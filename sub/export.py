@@ -0,0 +1,218 @@
+import argparse
+import csv
+import io
+import os
+import sqlite3
+import sys
+import time
+from datetime import datetime
+from typing import Any, List, Optional, Sequence, Tuple
+from urllib.parse import quote
+
+from dotenv import load_dotenv
+
+# ----------------------------
+# Streaming export of measurements
+# ----------------------------
+#
+# Shared by the /api/export endpoint and this module's CLI. Writers turn row
+# batches into output chunks one batch at a time, so memory stays constant
+# however large the exported range is.
+
+EXPORT_FORMATS = ("csv", "arrow", "parquet")
+
+MEDIA_TYPES = {
+    "csv": "text/csv",
+    "arrow": "application/vnd.apache.arrow.stream",
+    "parquet": "application/vnd.apache.parquet",
+}
+
+# SQLite column -> Arrow type name for the columnar formats. Every column of
+# measurements needs an entry; a new one must be added here as well.
+COLUMN_TYPES = {
+    "id": "int64",
+    "device_id": "string",
+    "topic": "string",
+    "dht22_temperature_c": "float64",
+    "dht22_humidity_percent": "float64",
+    "bmp280_temperature_c": "float64",
+    "bmp280_pressure_pa": "float64",
+    "timestamp_device": "int64",
+    "timestamp_server": "int64",
+    "firmware_version": "string",
+    "rssi": "int64",
+    "altitude_m": "float64",
+    "free_heap": "int64",
+    "quality": "int64",
+    "dew_point_c": "float64",
+    "absolute_humidity_gm3": "float64",
+    "pressure_qnh_pa": "float64",
+    "pressure_tendency_pa_3h": "float64",
+}
+
+
+def export_query(
+    device_ids: Sequence[str], start: Optional[int], end: Optional[int]
+) -> Tuple[str, List[Any]]:
+    """SELECT for a time range and device selection, in ingest order."""
+    conditions = []
+    params: List[Any] = []
+    if device_ids:
+        conditions.append(f"device_id IN ({', '.join('?' for _ in device_ids)})")
+        params.extend(device_ids)
+    if start is not None:
+        conditions.append("timestamp_server >= ?")
+        params.append(start)
+    if end is not None:
+        conditions.append("timestamp_server < ?")
+        params.append(end)
+
+    where = f"WHERE {' AND '.join(conditions)}" if conditions else ""
+    return f"SELECT * FROM measurements {where} ORDER BY timestamp_server, id", params
+
+
+class CsvWriter:
+    def begin(self, columns: Sequence[str]) -> bytes:
+        return self._rows([columns])
+
+    def write(self, batch: Sequence[Sequence[Any]]) -> bytes:
+        return self._rows(batch)
+
+    def end(self) -> bytes:
+        return b""
+
+    @staticmethod
+    def _rows(rows) -> bytes:
+        buffer = io.StringIO()
+        csv.writer(buffer).writerows(rows)
+        return buffer.getvalue().encode("utf-8")
+
+
+class _ChunkSink:
+    """Write-only file object that hands back whatever was written since last drain."""
+
+    def __init__(self):
+        self.chunks: List[bytes] = []
+        self.closed = False
+
+    def write(self, data) -> int:
+        self.chunks.append(bytes(data))
+        return len(data)
+
+    def flush(self) -> None:
+        pass
+
+    def close(self) -> None:
+        self.closed = True
+
+    def drain(self) -> bytes:
+        data = b"".join(self.chunks)
+        self.chunks.clear()
+        return data
+
+
+class ArrowWriter:
+    """Arrow IPC stream or Parquet, one record batch / row group per input batch."""
+
+    def __init__(self, fmt: str):
+        try:
+            import pyarrow  # noqa: F401
+        except ImportError:
+            raise RuntimeError(f"{fmt} export requires pyarrow (pip install pyarrow)")
+        self.fmt = fmt
+        self.sink = _ChunkSink()
+        self.writer = None
+        self.schema = None
+
+    def begin(self, columns: Sequence[str]) -> bytes:
+        import pyarrow as pa
+
+        unknown = [c for c in columns if c not in COLUMN_TYPES]
+        if unknown:
+            raise ValueError(f"No Arrow type for column(s) {', '.join(unknown)}, add them to COLUMN_TYPES")
+        self.schema = pa.schema([(c, getattr(pa, COLUMN_TYPES[c])()) for c in columns])
+        stream = pa.PythonFile(self.sink, mode="w")
+        if self.fmt == "parquet":
+            import pyarrow.parquet as pq
+
+            self.writer = pq.ParquetWriter(stream, self.schema, compression="zstd")
+        else:
+            self.writer = pa.ipc.new_stream(stream, self.schema)
+        return self.sink.drain()
+
+    def write(self, batch: Sequence[Sequence[Any]]) -> bytes:
+        import pyarrow as pa
+
+        arrays = [
+            pa.array([row[i] for row in batch], type=field.type)
+            for i, field in enumerate(self.schema)
+        ]
+        self.writer.write_batch(pa.RecordBatch.from_arrays(arrays, schema=self.schema))
+        return self.sink.drain()
+
+    def end(self) -> bytes:
+        self.writer.close()
+        return self.sink.drain()
+
+
+def make_writer(fmt: str):
+    if fmt not in EXPORT_FORMATS:
+        raise ValueError(f"Unknown export format {fmt!r}, expected one of {', '.join(EXPORT_FORMATS)}")
+    return CsvWriter() if fmt == "csv" else ArrowWriter(fmt)
+
+
+# ----------------------------
+# CLI
+# ----------------------------
+
+
+def parse_time(value: str) -> int:
+    """Unix seconds or an ISO 8601 date/datetime (local time if no offset)."""
+    try:
+        return int(value)
+    except ValueError:
+        return int(datetime.fromisoformat(value).timestamp())
+
+
+def main():
+    load_dotenv()
+
+    parser = argparse.ArgumentParser(description="Export measurements as CSV, Arrow IPC or Parquet")
+    parser.add_argument("--db", default=os.getenv("SQLITE_DB", "environment_data.db"))
+    parser.add_argument("--format", choices=EXPORT_FORMATS, default="csv")
+    parser.add_argument("--device", action="append", default=[], help="repeat for several devices")
+    parser.add_argument("--start", type=parse_time, help="inclusive, unix seconds or ISO date")
+    parser.add_argument("--end", type=parse_time, help="exclusive, unix seconds or ISO date")
+    parser.add_argument("--batch-size", type=int, default=10000)
+    parser.add_argument("-o", "--output", help="output file (default: stdout)")
+    args = parser.parse_args()
+
+    db_path = os.path.abspath(args.db)
+    conn = sqlite3.connect(f"file:{quote(db_path)}?mode=ro", uri=True)
+    query, params = export_query(args.device, args.start, args.end)
+
+    writer = make_writer(args.format)
+    out = open(args.output, "wb") if args.output else sys.stdout.buffer
+
+    t0 = time.perf_counter()
+    rows = 0
+    # One statement is one snapshot: ingest keeps writing to the WAL while
+    # the export reads a consistent view.
+    cursor = conn.execute(query, params)
+    out.write(writer.begin([d[0] for d in cursor.description]))
+    while True:
+        batch = cursor.fetchmany(args.batch_size)
+        if not batch:
+            break
+        out.write(writer.write(batch))
+        rows += len(batch)
+    out.write(writer.end())
+
+    if args.output:
+        out.close()
+    conn.close()
+    print(f"Exported {rows} rows in {time.perf_counter() - t0:.1f}s", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,201 @@
+import gzip
+import hashlib
+import mimetypes
+import re
+from pathlib import Path
+from typing import Dict, Optional, Tuple
+
+from starlette.datastructures import Headers, MutableHeaders
+from starlette.responses import Response
+
+try:
+    import brotli
+except ImportError:  # optional, gzip only without it
+    brotli = None
+
+# ----------------------------
+# Response compression and conditional requests
+# ----------------------------
+#
+# Small helpers for web_server.py:
+#
+#   - CompressionMiddleware compresses complete (non-streamed) responses of
+#     text-like types with brotli or gzip, whichever the client accepts.
+#   - StaticAssets serves the files in static/ from memory, compressed once at
+#     startup, under fingerprinted names (dashboard.<hash>.js) that can be
+#     cached for a year because a changed file gets a new URL.
+#   - etag_matches() implements the If-None-Match comparison for API ETags.
+
+COMPRESSIBLE_TYPES = {
+    "application/json",
+    "application/javascript",
+    "image/svg+xml",
+    "text/css",
+    "text/csv",
+    "text/html",
+    "text/javascript",
+    "text/plain",
+}
+
+# Bodies below this size gain little and cost a header line.
+MIN_COMPRESS_SIZE = 512
+
+FINGERPRINT_LENGTH = 10
+IMMUTABLE = "public, max-age=31536000, immutable"
+FINGERPRINTED_NAME = re.compile(rf"^(.*)\.([0-9a-f]{{{FINGERPRINT_LENGTH}}})(\.[^./]+)$")
+
+
+def choose_encoding(accept_encoding: Optional[str]) -> Optional[str]:
+    """Pick "br" or "gzip" from an Accept-Encoding header, or None."""
+    if not accept_encoding:
+        return None
+
+    accepted = set()
+    for item in accept_encoding.split(","):
+        name, _, params = item.strip().partition(";")
+        q = params.strip()
+        if q.startswith("q=") and q[2:].strip() in ("0", "0.0", "0.00", "0.000"):
+            continue
+        accepted.add(name.strip().lower())
+
+    if brotli is not None and ("br" in accepted or "*" in accepted):
+        return "br"
+    if "gzip" in accepted or "*" in accepted:
+        return "gzip"
+    return None
+
+
+def compress(body: bytes, encoding: str, best: bool = False) -> bytes:
+    # Per response a fast level; static assets are compressed once, at the best.
+    if encoding == "br":
+        return brotli.compress(body, quality=11 if best else 5)
+    # mtime=0 keeps the output identical for identical input.
+    return gzip.compress(body, compresslevel=9 if best else 6, mtime=0)
+
+
+def etag_matches(if_none_match: Optional[str], etag: str) -> bool:
+    """Weak comparison of an ETag against an If-None-Match header."""
+    if not if_none_match:
+        return False
+    if if_none_match.strip() == "*":
+        return True
+    wanted = etag.removeprefix("W/")
+    return any(tag.strip().removeprefix("W/") == wanted for tag in if_none_match.split(","))
+
+
+class CompressionMiddleware:
+    """
+    ASGI middleware compressing responses that arrive as one body message.
+    Streamed responses (exports, the query console, server-sent events) and
+    responses that already carry a Content-Encoding pass through untouched.
+    """
+
+    def __init__(self, app, minimum_size: int = MIN_COMPRESS_SIZE):
+        self.app = app
+        self.minimum_size = minimum_size
+
+    async def __call__(self, scope, receive, send):
+        if scope["type"] != "http":
+            await self.app(scope, receive, send)
+            return
+
+        encoding = choose_encoding(Headers(scope=scope).get("accept-encoding"))
+        if encoding is None:
+            await self.app(scope, receive, send)
+            return
+
+        start = None
+
+        async def send_compressed(message):
+            nonlocal start
+            if message["type"] == "http.response.start":
+                start = message
+                return
+            if start is None:
+                await send(message)
+                return
+
+            response_start, start = start, None
+            headers = MutableHeaders(raw=response_start["headers"])
+            media_type = headers.get("content-type", "").split(";")[0].strip()
+            body = message.get("body", b"")
+
+            if media_type not in COMPRESSIBLE_TYPES or "content-encoding" in headers:
+                await send(response_start)
+                await send(message)
+                return
+
+            headers.add_vary_header("Accept-Encoding")
+            if message.get("more_body") or len(body) < self.minimum_size:
+                await send(response_start)
+                await send(message)
+                return
+
+            body = compress(body, encoding)
+            headers["Content-Encoding"] = encoding
+            headers["Content-Length"] = str(len(body))
+            await send(response_start)
+            await send({"type": "http.response.body", "body": body})
+
+        await self.app(scope, receive, send_compressed)
+
+
+class StaticAssets:
+    """
+    The files of one directory, held in memory with their compressed forms.
+    Loaded once at startup: restart the web server after changing a file.
+    """
+
+    def __init__(self, directory: Path):
+        self.files: Dict[str, Tuple[str, str, Dict[Optional[str], bytes]]] = {}
+        for path in sorted(directory.rglob("*")):
+            if not path.is_file():
+                continue
+            name = path.relative_to(directory).as_posix()
+            body = path.read_bytes()
+            fingerprint = hashlib.sha256(body).hexdigest()[:FINGERPRINT_LENGTH]
+            media_type = mimetypes.guess_type(name)[0] or "application/octet-stream"
+
+            variants: Dict[Optional[str], bytes] = {None: body}
+            if media_type in COMPRESSIBLE_TYPES:
+                for encoding in ("gzip", "br") if brotli is not None else ("gzip",):
+                    variants[encoding] = compress(body, encoding, best=True)
+            self.files[name] = (fingerprint, media_type, variants)
+
+    def url(self, name: str) -> str:
+        """Fingerprinted URL of a file, for templates."""
+        fingerprint = self.files[name][0]
+        stem, dot, suffix = name.rpartition(".")
+        if not dot:
+            return f"/static/{name}.{fingerprint}"
+        return f"/static/{stem}.{fingerprint}.{suffix}"
+
+    def response(self, path: str, headers: Headers) -> Response:
+        requested = None
+        match = FINGERPRINTED_NAME.match(path)
+        if match and f"{match.group(1)}{match.group(3)}" in self.files:
+            path, requested = f"{match.group(1)}{match.group(3)}", match.group(2)
+
+        if path not in self.files:
+            return Response(status_code=404)
+        fingerprint, media_type, variants = self.files[path]
+
+        encoding = choose_encoding(headers.get("accept-encoding"))
+        if encoding not in variants:
+            encoding = None
+
+        response_headers = {
+            "ETag": f'"{fingerprint}{"-" + encoding if encoding else ""}"',
+            # Only the current fingerprint is immutable. Plain names, and
+            # stale fingerprints from a page cached before a deploy, get
+            # the current file and must revalidate.
+            "Cache-Control": IMMUTABLE if requested == fingerprint else "no-cache",
+        }
+        if len(variants) > 1:
+            response_headers["Vary"] = "Accept-Encoding"
+        if etag_matches(headers.get("if-none-match"), response_headers["ETag"]):
+            return Response(status_code=304, headers=response_headers)
+
+        if encoding:
+            response_headers["Content-Encoding"] = encoding
+        return Response(variants[encoding], media_type=media_type, headers=response_headers)
@@ -0,0 +1,387 @@
+import argparse
+import gzip
+import json
+import logging
+import math
+import multiprocessing
+import os
+import sqlite3
+import sys
+import time
+from collections import deque
+from itertools import islice
+from typing import Deque, Dict, Iterable, Iterator, List, Optional, Tuple
+
+from dotenv import load_dotenv
+
+from derived import DerivedFields, load_elevations
+from quality import QualityDetector
+from storage import (
+    INSERT_MEASUREMENT_SQL,
+    MEASUREMENT_COLUMNS,
+    SQLITE_INT_MAX,
+    SQLITE_INT_MIN,
+    InvalidPayload,
+    init_db,
+    measurement_from_payload,
+    merge_device_aggregates,
+    reserve_ids,
+)
+
+# ----------------------------
+# Bulk import of archived messages
+# ----------------------------
+#
+# Loads readings that never went through main.py, e.g. data a node buffered
+# during an outage or a broker-side capture, without main.py's per-message
+# commit. Input files hold one message per line, in any of these forms:
+#
+#   {"device_id": ..., "ts_device": ..., ...}               mqtt_pub.c payload
+#   {"topic": ..., "payload": {...} or "...", "ts": ...}    captured message
+#   sensors/<node>/environment {"device_id": ...}           mosquitto_sub -v
+#   1760000000.123 sensors/<node>/environment {...}          mosquitto_sub -F "%U %t %p"
+#
+# Bare payloads get the topic mqtt_pub.c would have used. A captured message
+# is stored with its capture time as timestamp_server, anything else with
+# ts_device, provided the node's clock was set (see MIN_DEVICE_TIME).
+#
+# The import runs in three steps:
+#
+#   1. Worker processes parse chunks of lines into rows, which are staged in
+#      a TEMP table (on disk, not in memory; see SQLITE_TMPDIR).
+#   2. Rows whose (device_id, ts_device) is already stored, or repeated in
+#      the input, are dropped. Only stored rows of the imported devices
+#      within the imported ts_device range are read for that.
+#   3. The remaining rows are flagged (quality.py) and their derived fields
+#      computed (derived.py) per device in time order, by the workers too,
+#      then inserted --batch-size rows per transaction. Each transaction
+#      also adds its rows to device_state and device_stats.
+#
+# main.py can keep running: it waits for the import's transactions, each a
+# fraction of a second at the default batch size. The Hampel windows and
+# pressure tendencies only see imported rows; where an import interleaves
+# with rows already stored, rerun quality.py and derived.py to recompute
+# them over the merged history. Alert rules are not evaluated on imports.
+
+load_dotenv()
+
+SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+STATION_ELEVATIONS = os.getenv("STATION_ELEVATIONS", "")
+
+# ts_device below this (2020-01-01) is seconds since boot, not Unix time:
+# time(NULL) before the node's SNTP sync.
+MIN_DEVICE_TIME = 1577836800
+
+# Columns filled by parsing; quality and the derived fields come later.
+PARSED_COLUMNS = MEASUREMENT_COLUMNS[: MEASUREMENT_COLUMNS.index("quality")]
+
+# Outcomes of parsing a line, counted per chunk.
+IMPORTED, INVALID, NO_TIME, NO_KEY = "parsed", "invalid", "no_time", "no_ts_device"
+
+mp = multiprocessing.get_context("spawn")
+
+
+def parse_line(line: bytes) -> Tuple[Optional[Tuple], str]:
+    """Row of PARSED_COLUMNS for one input line, or None and the reason."""
+    line = line.strip()
+    if not line:
+        return None, INVALID
+    received = None
+    topic = None
+    try:
+        if line[:1] == b"{":
+            message = json.loads(line)
+            if isinstance(message, dict) and "payload" in message and "topic" in message:
+                topic = message["topic"]
+                received = message.get("ts")
+                message = message["payload"]
+                if isinstance(message, str):
+                    message = json.loads(message)
+        else:
+            first, _, rest = line.partition(b" ")
+            if first[:1].isdigit():
+                received = float(first)
+                first, _, rest = rest.partition(b" ")
+            topic = first.decode("utf-8")
+            message = json.loads(rest)
+    except ValueError:
+        # Covers invalid UTF-8, invalid JSON and a malformed capture time.
+        return None, INVALID
+    if not isinstance(message, dict) or not isinstance(topic, (str, type(None))):
+        return None, INVALID
+
+    ts_device = message.get("ts_device")
+    if not isinstance(ts_device, int) or isinstance(ts_device, bool):
+        return None, NO_KEY
+    if isinstance(received, (int, float)) and not isinstance(received, bool):
+        # NaN, 1e999 and the like would fail int() or the insert.
+        if not math.isfinite(received) or not SQLITE_INT_MIN <= received <= SQLITE_INT_MAX:
+            return None, INVALID
+        now = int(received)
+    elif ts_device >= MIN_DEVICE_TIME:
+        now = ts_device
+    else:
+        return None, NO_TIME
+
+    if topic is None:
+        topic = f"sensors/{message.get('device_id', 'unknown')}/environment"
+    try:
+        measurement = measurement_from_payload(topic, message, now)
+    except InvalidPayload:
+        return None, INVALID
+    return tuple(measurement[c] for c in PARSED_COLUMNS), IMPORTED
+
+
+def parse_chunk(lines: List[bytes]) -> Tuple[List[Tuple], Dict[str, int]]:
+    rows = []
+    counts = dict.fromkeys((IMPORTED, INVALID, NO_TIME, NO_KEY), 0)
+    for line in lines:
+        row, outcome = parse_line(line)
+        counts[outcome] += 1
+        if row is not None:
+            rows.append(row)
+    return rows, counts
+
+
+def read_chunks(paths: Iterable[str], size: int) -> Iterator[List[bytes]]:
+    for path in paths:
+        if path == "-":
+            f = sys.stdin.buffer
+        elif path.endswith(".gz"):
+            f = gzip.open(path, "rb")
+        else:
+            f = open(path, "rb")
+        with f:
+            while True:
+                chunk = list(islice(f, size))
+                if not chunk:
+                    break
+                yield chunk
+
+
+# ----------------------------
+# Steps
+# ----------------------------
+
+
+def stage(conn: sqlite3.Connection, paths: List[str], workers: int, chunk_lines: int) -> Dict[str, int]:
+    """Parse the input into TEMP.import_rows; returns the parse outcome counts."""
+    columns = ", ".join(PARSED_COLUMNS)
+    conn.execute("PRAGMA temp_store=FILE")
+    conn.execute("DROP TABLE IF EXISTS temp.import_rows")
+    conn.execute(f"CREATE TEMP TABLE import_rows ({columns})")
+    insert = f"INSERT INTO temp.import_rows VALUES ({', '.join('?' for _ in PARSED_COLUMNS)})"
+
+    totals = dict.fromkeys((IMPORTED, INVALID, NO_TIME, NO_KEY), 0)
+
+    def add(rows, counts):
+        conn.executemany(insert, rows)
+        for outcome, n in counts.items():
+            totals[outcome] += n
+
+    chunks = read_chunks(paths, chunk_lines)
+    if workers <= 0:
+        for chunk in chunks:
+            add(*parse_chunk(chunk))
+    else:
+        # Pool.imap would read the whole input ahead; keeping at most two
+        # chunks per worker in flight bounds memory however large it is.
+        with mp.Pool(workers) as pool:
+            pending: Deque = deque()
+            for chunk in chunks:
+                pending.append(pool.apply_async(parse_chunk, (chunk,)))
+                if len(pending) >= 2 * workers:
+                    add(*pending.popleft().get())
+            while pending:
+                add(*pending.popleft().get())
+    conn.commit()
+    return totals
+
+
+def drop_duplicates(conn: sqlite3.Connection) -> int:
+    """
+    Reduce TEMP.import_rows to rows whose (device_id, timestamp_device) is
+    neither stored nor repeated; returns how many are left.
+    """
+    conn.execute("CREATE INDEX temp.import_rows_key ON import_rows(device_id, timestamp_device)")
+    # There is no index on timestamp_device in measurements; each imported
+    # device's rows are read once, through the primary key prefix.
+    conn.execute("DROP TABLE IF EXISTS temp.stored_keys")
+    conn.execute("""
+        CREATE TEMP TABLE stored_keys AS
+        SELECT m.device_id, m.timestamp_device
+        FROM (
+            SELECT device_id, MIN(timestamp_device) AS low, MAX(timestamp_device) AS high
+            FROM temp.import_rows
+            GROUP BY device_id
+        ) r
+        JOIN measurements m ON m.device_id = r.device_id
+        WHERE m.timestamp_device BETWEEN r.low AND r.high
+    """)
+    conn.execute("CREATE INDEX temp.stored_keys_key ON stored_keys(device_id, timestamp_device)")
+    conn.execute("""
+        DELETE FROM temp.import_rows
+        WHERE rowid NOT IN (
+            SELECT MIN(rowid) FROM temp.import_rows GROUP BY device_id, timestamp_device
+        )
+        OR EXISTS (
+            SELECT 1 FROM temp.stored_keys s
+            WHERE s.device_id = import_rows.device_id
+              AND s.timestamp_device = import_rows.timestamp_device
+        )
+    """)
+    conn.execute("DROP TABLE temp.stored_keys")
+    conn.commit()
+    return conn.execute("SELECT COUNT(*) FROM temp.import_rows").fetchone()[0]
+
+
+def flag_rows(task: Tuple[QualityDetector, DerivedFields, List[Tuple]]):
+    """
+    Quality flags and derived fields for the next rows of one device, in
+    time order. Takes the device's detector state and returns it updated,
+    so successive chunks can run in different worker processes.
+    """
+    detector, derived, rows = task
+    out = []
+    for values in rows:
+        measurement = dict(zip(PARSED_COLUMNS, values))
+        measurement["quality"] = detector.check(measurement)
+        derived.fill(measurement)
+        out.append(tuple(measurement[c] for c in MEASUREMENT_COLUMNS))
+    return detector, derived, out
+
+
+def insert_rows(conn: sqlite3.Connection, rows: List[Tuple]) -> None:
+    first_id = reserve_ids(conn, len(rows))
+    rows = [(first_id + i, *row) for i, row in enumerate(rows)]
+    conn.executemany(INSERT_MEASUREMENT_SQL, rows)
+    merge_device_aggregates(conn, [dict(zip(("id", *MEASUREMENT_COLUMNS), row)) for row in rows])
+    conn.commit()
+
+
+def load(
+    conn: sqlite3.Connection,
+    elevations: Dict[str, float],
+    workers: int,
+    chunk_rows: int,
+    batch_size: int,
+    pause: float,
+) -> Tuple[int, int]:
+    """Flag, derive and insert the staged rows; returns rows inserted and flagged."""
+    # Each chunk is its own query, read to the end: a statement left open
+    # across a commit keeps a read transaction on the database, and the next
+    # insert fails with SQLITE_BUSY_SNAPSHOT once main.py has written.
+    conn.execute(
+        "CREATE INDEX temp.import_rows_order ON import_rows(device_id, timestamp_server, timestamp_device)"
+    )
+    select = f"""
+        SELECT timestamp_server, timestamp_device, rowid, {", ".join(PARSED_COLUMNS)}
+        FROM temp.import_rows
+        WHERE device_id = ? AND (timestamp_server, timestamp_device, rowid) > (?, ?, ?)
+        ORDER BY timestamp_server, timestamp_device, rowid
+        LIMIT ?
+    """
+    start = (SQLITE_INT_MIN, SQLITE_INT_MIN, SQLITE_INT_MIN)
+    quality_index = MEASUREMENT_COLUMNS.index("quality")
+    waiting = iter([row[0] for row in conn.execute("SELECT DISTINCT device_id FROM temp.import_rows")])
+    # Devices are independent, so up to `workers` of them are processed at
+    # once, one chunk each per round; each device's chunks run in order.
+    active: List[list] = []
+    ready: List[Tuple] = []
+    inserted = flagged = 0
+
+    pool = mp.Pool(workers) if workers > 0 else None
+    try:
+        while True:
+            while len(active) < max(workers, 1):
+                device_id = next(waiting, None)
+                if device_id is None:
+                    break
+                active.append([device_id, start, QualityDetector(), DerivedFields(elevations)])
+            if not active:
+                break
+
+            tasks = []
+            for device in list(active):
+                rows = conn.execute(select, (device[0], *device[1], chunk_rows)).fetchall()
+                if rows:
+                    device[1] = rows[-1][:3]
+                    tasks.append((device, [row[3:] for row in rows]))
+                else:
+                    active.remove(device)
+            work = [(detector, derived, rows) for (_, _, detector, derived), rows in tasks]
+            results = pool.map(flag_rows, work, chunksize=1) if pool else list(map(flag_rows, work))
+
+            for (device, _), (detector, derived, rows) in zip(tasks, results):
+                device[2:] = detector, derived
+                ready.extend(rows)
+                flagged += sum(1 for row in rows if row[quality_index])
+            while len(ready) >= batch_size or (ready and not active):
+                insert_rows(conn, ready[:batch_size])
+                inserted += len(ready[:batch_size])
+                del ready[:batch_size]
+                logging.info(f"Inserted {inserted} rows")
+                if pause:
+                    time.sleep(pause)
+    finally:
+        if pool:
+            pool.close()
+            pool.join()
+    return inserted, flagged
+
+
+def main():
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
+
+    parser = argparse.ArgumentParser(description="Bulk import of archived sensor messages")
+    parser.add_argument("paths", nargs="+", help="JSONL or capture files (.gz allowed, - for stdin)")
+    parser.add_argument("--db", default=SQLITE_DB, help="SQLite database (default: $SQLITE_DB)")
+    parser.add_argument(
+        "--elevations",
+        default=STATION_ELEVATIONS,
+        help="JSON file of station elevations (default: $STATION_ELEVATIONS)",
+    )
+    parser.add_argument(
+        "--workers", type=int, default=os.cpu_count() or 1, help="parser processes, 0 to parse in-process"
+    )
+    parser.add_argument("--chunk-lines", type=int, default=20000, help="lines (rows) per worker task")
+    parser.add_argument("--batch-size", type=int, default=20000, help="rows per insert transaction")
+    parser.add_argument("--pause", type=float, default=0.0, help="seconds between insert transactions")
+    args = parser.parse_args()
+
+    elevations = load_elevations(args.elevations) if args.elevations else {}
+
+    conn = sqlite3.connect(args.db, timeout=60)
+    init_db(conn)
+
+    t_start = time.perf_counter()
+    counts = stage(conn, args.paths, args.workers, args.chunk_lines)
+    lines = sum(counts.values())
+    t_parsed = time.perf_counter()
+    logging.info(
+        f"Parsed {lines} lines in {t_parsed - t_start:.1f}s ({lines / max(t_parsed - t_start, 1e-9):.0f} lines/s): "
+        f"{counts[IMPORTED]} rows, {counts[INVALID]} invalid, "
+        f"{counts[NO_KEY]} without ts_device, {counts[NO_TIME]} without a usable time"
+    )
+
+    new = drop_duplicates(conn)
+    t_deduped = time.perf_counter()
+    logging.info(
+        f"{counts[IMPORTED] - new} duplicates dropped, {new} new rows ({t_deduped - t_parsed:.1f}s)"
+    )
+
+    inserted, flagged = load(conn, elevations, args.workers, args.chunk_lines, args.batch_size, args.pause)
+    t_loaded = time.perf_counter()
+    logging.info(f"Inserted {inserted} rows, {flagged} flagged, in {t_loaded - t_deduped:.1f}s")
+
+    conn.close()
+
+    elapsed = t_loaded - t_start
+    logging.info(
+        f"Imported {inserted} of {lines} lines in {elapsed:.1f}s "
+        f"({lines / elapsed:.0f} lines/s, {inserted / elapsed:.0f} rows/s)"
+    )
+
+
+if __name__ == "__main__":
+    main()
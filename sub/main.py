@@ -1,13 +1,24 @@
 import json
 import time
+import queue
+import signal
 import sqlite3
 import logging
+import multiprocessing
 import os
-from typing import Any, Dict
+from array import array
+from typing import Any, Dict, List, Optional, Sequence, Tuple
 
 from dotenv import load_dotenv
 import paho.mqtt.client as mqtt
 
+import metrics
+from alerts import AlertEngine, AlertSink, load_rules
+from derived import DerivedFields, load_elevations
+from notify import Notifier
+from quality import QualityDetector
+from storage import InvalidPayload, init_db, insert_measurement, measurement_from_payload
+
 # ----------------------------
 # Load environment variables
 # ----------------------------
@@ -22,6 +33,41 @@ MQTT_TOPIC = os.getenv("MQTT_TOPIC", "sensors/#")
 
 SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
 
+NOTIFY_HOST = os.getenv("NOTIFY_HOST", "127.0.0.1")
+NOTIFY_PORT = int(os.getenv("NOTIFY_PORT", "8765"))
+
+# 0 runs ingest in this process. N > 0 starts N worker processes on a shared
+# subscription ($share/<group>/<topic>) that parse messages and hand them to
+# this process, the only one writing to SQLite.
+INGEST_WORKERS = int(os.getenv("INGEST_WORKERS", "0"))
+MQTT_SHARE_GROUP = os.getenv("MQTT_SHARE_GROUP", "meteo-ingest")
+WRITE_BATCH_SIZE = int(os.getenv("WRITE_BATCH_SIZE", "500"))
+WRITE_BATCH_MS = float(os.getenv("WRITE_BATCH_MS", "50"))
+WRITE_QUEUE_SIZE = 10000
+# A batch waits for the write lock this many more times (each up to the
+# connection's 5 s timeout, then WRITE_RETRY_PAUSE) before it is dropped.
+WRITE_RETRIES = 5
+WRITE_RETRY_PAUSE = 1.0
+
+# Prometheus metrics at http://METRICS_HOST:METRICS_PORT/metrics; port 0 disables.
+METRICS_HOST = os.getenv("METRICS_HOST", "127.0.0.1")
+METRICS_PORT = int(os.getenv("METRICS_PORT", "9101"))
+
+# Alert rules (JSON file, see alerts.py); empty disables alerting. Alerts go to
+# the log and to ALERT_WEBHOOK (JSON POST) and/or ALERT_FILE (JSON lines).
+ALERT_RULES = os.getenv("ALERT_RULES", "")
+ALERT_WEBHOOK = os.getenv("ALERT_WEBHOOK", "")
+ALERT_FILE = os.getenv("ALERT_FILE", "")
+ALERT_CHECK_INTERVAL = float(os.getenv("ALERT_CHECK_INTERVAL", "10"))
+
+# Station elevations for QNH (JSON file of device_id -> metres, see derived.py);
+# devices not listed get no QNH.
+STATION_ELEVATIONS = os.getenv("STATION_ELEVATIONS", "")
+
+# Workers start from a fresh interpreter rather than a fork of the writer,
+# so they never inherit its open SQLite connection.
+mp = multiprocessing.get_context("spawn")
+
 LOG_LEVEL = os.getenv("LOG_LEVEL", "INFO").upper()
 
 # ----------------------------
@@ -34,131 +80,351 @@ logging.basicConfig(
 )
 
 # ----------------------------
-# Database
+# Metrics
 # ----------------------------
 
+# Message counters of each process reading from the broker, indexed by
+# RECEIVED and PARSE_FAILED: a local array when ingesting in-process, one
+# shared-memory array per worker otherwise, summed at scrape time. Each array
+# has a single writer, so increments need no lock.
+RECEIVED, PARSE_FAILED = 0, 1
+message_stats: List[Sequence[int]] = []
 
-def init_db(conn: sqlite3.Connection) -> None:
-    cursor = conn.cursor()
-    cursor.execute("""
-        CREATE TABLE IF NOT EXISTS measurements (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
 
-            device_id TEXT NOT NULL,
-            topic TEXT NOT NULL,
+def message_counter(index: int):
+    return lambda: [((), sum(stats[index] for stats in message_stats))]
 
-            dht22_temperature_c REAL,
-            dht22_humidity_percent REAL,
 
-            bmp280_temperature_c REAL,
-            bmp280_pressure_pa REAL,
+rows_stored = metrics.Counter("meteo_ingest_rows_stored_total", "Measurements committed to SQLite.")
+rows_flagged = metrics.Counter(
+    "meteo_ingest_rows_flagged_total", "Stored measurements with a non-zero quality mask."
+)
+rows_rejected = metrics.Counter(
+    "meteo_ingest_rows_rejected_total", "Measurements refused by the insert (wrong field types)."
+)
+batch_errors = metrics.Counter(
+    "meteo_ingest_batch_errors_total", "Write batches rolled back and dropped on an error."
+)
+insert_seconds = metrics.Histogram(
+    "meteo_ingest_insert_seconds", "Time to insert one measurement and update its aggregates."
+)
+commit_seconds = metrics.Histogram("meteo_ingest_commit_seconds", "Time to commit one write batch.")
+batch_size = metrics.Histogram(
+    "meteo_ingest_batch_size",
+    "Measurements per write transaction.",
+    buckets=(1, 2, 5, 10, 20, 50, 100, 200, 500, 1000),
+)
+rows_out_of_order = metrics.Counter(
+    "meteo_ingest_rows_out_of_order_total",
+    "Rows stored after a newer row (by ts_device) of the same device.",
+)
+worker_restarts = metrics.Counter(
+    "meteo_ingest_worker_restarts_total", "Ingest worker processes restarted after exiting."
+)
 
-            timestamp_device INTEGER,
-            timestamp_server INTEGER NOT NULL,
+INGEST_METRICS: List[metrics.Metric] = [
+    metrics.Callback(
+        "meteo_ingest_messages_received_total",
+        "MQTT messages received.",
+        "counter",
+        message_counter(RECEIVED),
+    ),
+    metrics.Callback(
+        "meteo_ingest_parse_failures_total",
+        "Messages that were not a JSON object, or had a field of the wrong type.",
+        "counter",
+        message_counter(PARSE_FAILED),
+    ),
+    rows_stored,
+    rows_flagged,
+    rows_rejected,
+    rows_out_of_order,
+    batch_errors,
+    insert_seconds,
+    commit_seconds,
+    batch_size,
+]
 
-            firmware_version TEXT,
-            rssi INTEGER,
-            altitude_m REAL,
-            free_heap INTEGER
-        )
-    """)
+# ----------------------------
+# Message handling
+# ----------------------------
 
-    cursor.execute("""
-        CREATE INDEX IF NOT EXISTS idx_device_time
-        ON measurements(device_id, timestamp_server)
-    """)
 
-    cursor.execute("""
-        CREATE INDEX IF NOT EXISTS idx_time
-        ON measurements(timestamp_server)
-    """)
+def parse_message(msg: mqtt.MQTTMessage, now: int) -> Optional[Dict[str, Any]]:
+    """Decode one MQTT message into a measurements row, or None if unusable."""
+    try:
+        payload = json.loads(msg.payload.decode("utf-8"))
+    except ValueError:
+        # Covers both invalid UTF-8 and invalid JSON.
+        logging.warning("Received non-JSON payload")
+        return None
+
+    if not isinstance(payload, dict):
+        logging.warning(f"Received JSON {type(payload).__name__} instead of an object on {msg.topic}")
+        return None
+
+    try:
+        return measurement_from_payload(msg.topic, payload, now)
+    except InvalidPayload as e:
+        logging.warning(f"Rejected payload on {msg.topic}: {e}")
+        return None
+
+
+# Runs where rows are written, in the order they are written, so one
+# instance sees every device's full stream even with ingest workers.
+detector = QualityDetector()
+# Same for derived fields, whose pressure tendency needs each device's history.
+derived = DerivedFields()
+# Same for alert rules, which need every device's readings in order.
+alert_engine: Optional[AlertEngine] = None
+# Newest ts_device stored per device, to count rows stored out of order.
+latest_device_ts: Dict[str, int] = {}
+
+
+# Errors that concern one row rather than the database: a value the insert
+# cannot bind, one the checks cannot handle, or one that breaks a constraint
+# (e.g. a NaN statistic stored as NULL). parse_message rejects such values
+# first; this keeps one that gets through from dropping the whole batch.
+ROW_ERRORS = (
+    TypeError,
+    ValueError,
+    OverflowError,
+    sqlite3.InterfaceError,
+    sqlite3.ProgrammingError,
+    sqlite3.IntegrityError,
+)
+
 
-    conn.commit()
+def store(conn: sqlite3.Connection, measurement: Dict[str, Any]) -> Optional[Tuple[Dict, Dict]]:
+    """
+    Flag and insert one measurement in the current transaction. A row that
+    fails is rolled back on its own and reported as None; SQLite errors
+    propagate.
+    """
+    conn.execute("SAVEPOINT measurement")
+    try:
+        measurement["quality"] = detector.check(measurement)
+        derived.fill(measurement)
+        started = time.perf_counter()
+        result = insert_measurement(conn, measurement)
+        insert_seconds.observe(time.perf_counter() - started)
+    except ROW_ERRORS as e:
+        # A field of the wrong type, e.g. a string where a number belongs.
+        conn.execute("ROLLBACK TO measurement")
+        rows_rejected.inc()
+        logging.warning(f"Rejected payload from {measurement['device_id']}: {e}")
+        result = None
+    conn.execute("RELEASE measurement")
+    return result
+
+
+def begin_write(conn: sqlite3.Connection) -> None:
+    """
+    Take the write lock for a batch. BEGIN IMMEDIATE takes it up front, so a
+    database held by another writer, such as import_archive.py, fails here
+    before any row went through the checks, and the batch can simply be
+    tried again.
+    """
+    for attempt in range(WRITE_RETRIES + 1):
+        try:
+            conn.execute("BEGIN IMMEDIATE")
+            return
+        except sqlite3.OperationalError as e:
+            if attempt == WRITE_RETRIES:
+                raise
+            logging.warning(f"Database busy ({e}), retrying the write batch")
+            time.sleep(WRITE_RETRY_PAUSE)
+
+
+def store_batch(conn: sqlite3.Connection, batch: List[Dict[str, Any]], notifier: Notifier) -> None:
+    """Write a batch in one transaction, then announce the committed rows."""
+    stored = []
+    try:
+        begin_write(conn)
+        for measurement in batch:
+            result = store(conn, measurement)
+            if result is not None:
+                stored.append(result)
+        started = time.perf_counter()
+        conn.commit()
+        commit_seconds.observe(time.perf_counter() - started)
+    except Exception as e:
+        # Never leave the transaction open: every later BEGIN would fail.
+        if conn.in_transaction:
+            conn.rollback()
+        batch_errors.inc()
+        logging.exception(f"Dropped a batch of {len(batch)}: {e}")
+        return
+
+    batch_size.observe(len(batch))
+    rows_stored.inc(len(stored))
+    rows_flagged.inc(sum(1 for reading, _ in stored if reading["quality"]))
+    for reading, _ in stored:
+        ts = reading["timestamp_device"]
+        if ts is None:
+            continue
+        latest = latest_device_ts.get(reading["device_id"])
+        if latest is not None and ts < latest:
+            rows_out_of_order.inc()
+        else:
+            latest_device_ts[reading["device_id"]] = ts
+
+    # Only announce rows that are committed and visible to readers.
+    for reading, state in stored:
+        notifier.send("measurement", {"reading": reading, "device": state})
+        if alert_engine:
+            alert_engine.evaluate(reading)
 
 
 # ----------------------------
-# MQTT Callbacks
+# MQTT Callbacks (single process)
 # ----------------------------
 
 
-def on_connect(client, userdata, flags, rc):
-    if rc == 0:
+def on_connect(client, userdata, flags, reason_code, properties):
+    if not reason_code.is_failure:
         logging.info("Connected to MQTT broker")
-        client.subscribe(MQTT_TOPIC)
+        client.subscribe(userdata["topic"], qos=1)
     else:
-        logging.error(f"MQTT connection failed with code {rc}")
+        logging.error(f"MQTT connection failed: {reason_code}")
+
 
+def on_message(client, userdata, msg):
+    stats = userdata["stats"]
+    stats[RECEIVED] += 1
+    measurement = parse_message(msg, int(time.time()))
+    if measurement is None:
+        stats[PARSE_FAILED] += 1
+        return
+    store_batch(userdata["db"], [measurement], userdata["notifier"])
 
-def safe_get(d: Dict[str, Any], *keys):
-    cur = d
-    for k in keys:
-        if not isinstance(cur, dict):
-            return None
-        cur = cur.get(k)
-    return cur
 
+def connect(client: mqtt.Client) -> None:
+    if MQTT_USERNAME and MQTT_PASSWORD:
+        client.username_pw_set(MQTT_USERNAME, MQTT_PASSWORD)
+    client.connect(MQTT_BROKER, MQTT_PORT, keepalive=60)
 
-def on_message(client, userdata, msg):
-    conn: sqlite3.Connection = userdata["db"]
-    now = int(time.time())
 
-    try:
-        payload = json.loads(msg.payload.decode("utf-8"))
-    except json.JSONDecodeError:
-        logging.warning("Received non-JSON payload")
-        return
+# ----------------------------
+# Worker processes (INGEST_WORKERS > 0)
+# ----------------------------
 
-    device_id = payload.get("device_id", "unknown")
-    firmware = payload.get("fw")
-    ts_device = payload.get("ts_device")
-    rssi = payload.get("rssi")
-    altitude_m = payload.get("altitude_m")
-    free_heap = payload.get("free_heap")
 
-    dht22_temp = safe_get(payload, "dht22", "temperature_c")
-    dht22_rh = safe_get(payload, "dht22", "humidity_percent")
+def on_worker_message(client, userdata, msg):
+    stats = userdata["stats"]
+    stats[RECEIVED] += 1
+    received = time.time()
+    measurement = parse_message(msg, int(received))
+    if measurement is None:
+        stats[PARSE_FAILED] += 1
+        return
+    # Blocks while the writer is behind, which stops this worker reading
+    # from the broker instead of growing memory.
+    userdata["queue"].put((measurement, received))
+
+
+def run_worker(index: int, write_queue: multiprocessing.Queue, stats) -> None:
+    topic = f"$share/{MQTT_SHARE_GROUP}/{MQTT_TOPIC}"
+    client = mqtt.Client(
+        mqtt.CallbackAPIVersion.VERSION2,
+        client_id=f"meteo-ingest-{index}",
+        protocol=mqtt.MQTTv5,
+        userdata={"topic": topic, "queue": write_queue, "stats": stats},
+    )
+    client.on_connect = on_connect
+    client.on_message = on_worker_message
+    connect(client)
+    logging.info(f"Ingest worker {index} subscribed to {topic}")
+    client.loop_forever()
 
-    bmp_temp = safe_get(payload, "bmp280", "temperature_c")
-    bmp_press = safe_get(payload, "bmp280", "pressure_pa")
 
+def ordering_key(item: Tuple[Dict[str, Any], float]):
+    # The broker hands consecutive messages of one device to different
+    # workers, so arrival order at the writer is not publish order. The
+    # device's own timestamp is; receive time only breaks ties within a second.
+    # This only reorders within the hold window: shared subscriptions give no
+    # device affinity, so a worker that falls further behind than
+    # WRITE_BATCH_MS can still deliver a device's row after a newer one.
+    measurement, received = item
+    ts = measurement["timestamp_device"]
+    return ts if isinstance(ts, int) else 0, received
+
+
+def start_worker(index: int, write_queue: multiprocessing.Queue) -> multiprocessing.Process:
+    process = mp.Process(
+        target=run_worker,
+        args=(index, write_queue, message_stats[index]),
+        name=f"ingest-worker-{index}",
+        daemon=True,
+    )
+    process.start()
+    return process
+
+
+def run_writer(conn: sqlite3.Connection, notifier: Notifier) -> None:
+    write_queue = mp.Queue(maxsize=WRITE_QUEUE_SIZE)
+    # A restarted worker keeps counting in the same array.
+    message_stats.extend(mp.Array("q", 2, lock=False) for _ in range(INGEST_WORKERS))
+
+    # Items wait here for one WRITE_BATCH_MS window after they were received,
+    # so a message that a slower worker delivers late can still be put in
+    # front of a newer one from the same device.
+    held: List[Tuple[Dict[str, Any], float]] = []
+    hold = WRITE_BATCH_MS / 1000
+
+    INGEST_METRICS.extend([
+        metrics.Callback(
+            "meteo_ingest_queue_depth",
+            "Parsed messages waiting for the writer.",
+            "gauge",
+            lambda: [((), write_queue.qsize())],
+        ),
+        metrics.Callback(
+            "meteo_ingest_held_rows",
+            "Rows held back by the writer for reordering.",
+            "gauge",
+            lambda: [((), len(held))],
+        ),
+        worker_restarts,
+    ])
+    workers = [start_worker(i, write_queue) for i in range(INGEST_WORKERS)]
+    logging.info(f"Writer started with {INGEST_WORKERS} ingest workers")
+    last_check = time.monotonic()
     try:
-        cursor = conn.cursor()
-        cursor.execute(
-            """
-            INSERT INTO measurements (
-                device_id,
-                topic,
-                dht22_temperature_c,
-                dht22_humidity_percent,
-                bmp280_temperature_c,
-                bmp280_pressure_pa,
-                timestamp_device,
-                timestamp_server,
-                firmware_version,
-                rssi,
-                altitude_m,
-                free_heap
-            ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
-        """,
-            (
-                device_id,
-                msg.topic,
-                dht22_temp,
-                dht22_rh,
-                bmp_temp,
-                bmp_press,
-                ts_device,
-                now,
-                firmware,
-                rssi,
-                altitude_m,
-                free_heap,
-            ),
-        )
-        conn.commit()
-        logging.info(f"Stored data from {device_id}")
-    except sqlite3.Error as e:
-        logging.error(f"SQLite error: {e}")
+        while True:
+            if time.monotonic() - last_check > 1:
+                last_check = time.monotonic()
+                for i, worker in enumerate(workers):
+                    if not worker.is_alive():
+                        logging.error(f"Ingest worker {i} exited ({worker.exitcode}), restarting")
+                        worker_restarts.inc()
+                        workers[i] = start_worker(i, write_queue)
+
+            # Collect for up to one window, or until a batch is full.
+            deadline = time.monotonic() + (hold if held else 1)
+            while len(held) < WRITE_BATCH_SIZE:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    break
+                try:
+                    held.append(write_queue.get(timeout=remaining))
+                except queue.Empty:
+                    break
+            if not held:
+                continue
+
+            held.sort(key=ordering_key)
+            cutoff = time.time() - hold
+            if len(held) >= WRITE_BATCH_SIZE:
+                ready, held = held, []
+            else:
+                ready = [item for item in held if item[1] <= cutoff]
+                held = [item for item in held if item[1] > cutoff]
+            if ready:
+                store_batch(conn, [measurement for measurement, _ in ready], notifier)
+    finally:
+        for worker in workers:
+            worker.terminate()
 
 
 # ----------------------------
@@ -166,18 +432,75 @@ def on_message(client, userdata, msg):
 # ----------------------------
 
 
+def stop(signum, frame):
+    raise SystemExit(0)
+
+
+def start_alerts(conn: sqlite3.Connection) -> AlertEngine:
+    rules = load_rules(ALERT_RULES)
+    sink = AlertSink(ALERT_WEBHOOK, ALERT_FILE) if ALERT_WEBHOOK or ALERT_FILE else None
+    engine = AlertEngine(rules, sink)
+    engine.warm(conn)
+    engine.run_checks(ALERT_CHECK_INTERVAL)
+
+    INGEST_METRICS.extend([
+        metrics.Callback(
+            "meteo_alerts_fired_total", "Alerts fired.", "counter", lambda: [((), engine.fired)]
+        ),
+        metrics.Callback(
+            "meteo_alerts_resolved_total", "Alerts resolved.", "counter", lambda: [((), engine.resolved)]
+        ),
+        metrics.Callback(
+            "meteo_alerts_suppressed_total",
+            "Evaluations that would have fired again within the hold-down.",
+            "counter",
+            lambda: [((), engine.suppressed)],
+        ),
+        metrics.Callback(
+            "meteo_alerts_undelivered_total",
+            "Alerts dropped on a full sink queue or failed to deliver.",
+            "counter",
+            lambda: [((), sink.dropped + sink.failed if sink else 0)],
+        ),
+    ])
+    logging.info(f"Loaded {len(rules)} alert rules from {ALERT_RULES}")
+    return engine
+
+
 def main():
+    global alert_engine
+
     conn = sqlite3.connect(SQLITE_DB, check_same_thread=False)
     init_db(conn)
+    detector.warm(conn)
+    if STATION_ELEVATIONS:
+        derived.elevations = load_elevations(STATION_ELEVATIONS)
+        logging.info(f"Loaded {len(derived.elevations)} station elevations from {STATION_ELEVATIONS}")
+    derived.warm(conn)
+    if ALERT_RULES:
+        alert_engine = start_alerts(conn)
+
+    notifier = Notifier(NOTIFY_HOST, NOTIFY_PORT)
+
+    if METRICS_PORT:
+        metrics.serve(INGEST_METRICS, METRICS_HOST, METRICS_PORT)
+        logging.info(f"Metrics on http://{METRICS_HOST}:{METRICS_PORT}/metrics")
+
+    if INGEST_WORKERS > 0:
+        # systemd stops the service with SIGTERM; unwind so workers are stopped.
+        signal.signal(signal.SIGTERM, stop)
+        run_writer(conn, notifier)
+        return
 
-    client = mqtt.Client(userdata={"db": conn})
+    stats = array("q", [0, 0])
+    message_stats.append(stats)
+    client = mqtt.Client(
+        mqtt.CallbackAPIVersion.VERSION2,
+        userdata={"db": conn, "notifier": notifier, "topic": MQTT_TOPIC, "stats": stats},
+    )
     client.on_connect = on_connect
     client.on_message = on_message
-
-    if MQTT_USERNAME and MQTT_PASSWORD:
-        client.username_pw_set(MQTT_USERNAME, MQTT_PASSWORD)
-
-    client.connect(MQTT_BROKER, MQTT_PORT, keepalive=60)
+    connect(client)
 
     logging.info("MQTT listener started")
     client.loop_forever()
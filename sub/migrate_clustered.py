@@ -0,0 +1,180 @@
+import argparse
+import logging
+import os
+import sqlite3
+import time
+
+from dotenv import load_dotenv
+
+from storage import (
+    MEASUREMENT_COLUMNS,
+    init_db,
+    is_clustered,
+    measurements_index_sql,
+    measurements_table_sql,
+)
+
+# ----------------------------
+# Online migration to the clustered measurements layout
+# ----------------------------
+#
+# Converts a database created with the old rowid measurements table (plus
+# idx_device_time and idx_time) to the WITHOUT ROWID layout clustered on
+# (device_id, timestamp_server, id), while main.py and web_server.py keep
+# running:
+#
+#   1. create measurements_clustered and triggers that mirror every insert,
+#      update and delete on measurements into it;
+#   2. copy the existing rows across in short id-range transactions;
+#   3. swap the tables in one quick transaction;
+#   4. delete the old rows in batches and drop the old table.
+#
+# Every step only holds the write lock for one batch, so ingest is delayed by
+# milliseconds rather than stopped. Safe to rerun after an interruption: the
+# copy skips rows that are already there. The file needs room for a second
+# copy of the table until step 4, which leaves the freed pages for reuse.
+
+load_dotenv()
+
+SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+
+logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
+
+STAGING = "measurements_clustered"
+COLUMNS = ("id",) + MEASUREMENT_COLUMNS
+TRIGGERS = ("migrate_measurements_insert", "migrate_measurements_update", "migrate_measurements_delete")
+
+
+def column_list(prefix: str = "") -> str:
+    return ", ".join(f"{prefix}{c}" for c in COLUMNS)
+
+
+def delete_key(prefix: str) -> str:
+    return (
+        f"DELETE FROM {STAGING} WHERE device_id = {prefix}.device_id"
+        f" AND timestamp_server = {prefix}.timestamp_server AND id = {prefix}.id;"
+    )
+
+
+def prepare(conn: sqlite3.Connection) -> int:
+    """Create the staging table and mirror triggers; return the last id to copy."""
+    conn.execute("BEGIN IMMEDIATE")
+    conn.execute(measurements_table_sql(STAGING))
+    for index_sql in measurements_index_sql(STAGING):
+        conn.execute(index_sql)
+
+    insert_new = f"INSERT OR REPLACE INTO {STAGING} ({column_list()}) VALUES ({column_list('NEW.')});"
+    conn.execute(f"""
+        CREATE TRIGGER IF NOT EXISTS {TRIGGERS[0]} AFTER INSERT ON measurements
+        BEGIN {insert_new} END
+    """)
+    conn.execute(f"""
+        CREATE TRIGGER IF NOT EXISTS {TRIGGERS[1]} AFTER UPDATE ON measurements
+        BEGIN {delete_key("OLD")} {insert_new} END
+    """)
+    conn.execute(f"""
+        CREATE TRIGGER IF NOT EXISTS {TRIGGERS[2]} AFTER DELETE ON measurements
+        BEGIN {delete_key("OLD")} END
+    """)
+
+    # Rows above this id arrive through the triggers, committed together with
+    # them so nothing falls between the copy and the mirror.
+    (last_id,) = conn.execute("SELECT COALESCE(MAX(id), 0) FROM measurements").fetchone()
+    conn.commit()
+    return last_id
+
+
+def copy_rows(conn: sqlite3.Connection, last_id: int, batch_size: int, pause: float) -> None:
+    copy_sql = f"""
+        INSERT OR IGNORE INTO {STAGING} ({column_list()})
+        SELECT {column_list()} FROM measurements WHERE id > ? AND id <= ?
+    """
+    t0 = time.perf_counter()
+    copied = 0
+    low = 0
+    while low < last_id:
+        high = min(low + batch_size, last_id)
+        copied += conn.execute(copy_sql, (low, high)).rowcount
+        conn.commit()
+        low = high
+
+        elapsed = time.perf_counter() - t0
+        logging.info(
+            f"Copied up to id {high}/{last_id} ({copied} rows, {copied / elapsed:.0f} rows/s)"
+        )
+        time.sleep(pause)
+
+
+def swap(conn: sqlite3.Connection) -> None:
+    # Both counts come from one read snapshot, where the triggers keep the
+    # tables equal, so the check does not need to hold the write lock.
+    conn.execute("BEGIN")
+    (old_count,) = conn.execute("SELECT COUNT(*) FROM measurements").fetchone()
+    (new_count,) = conn.execute(f"SELECT COUNT(*) FROM {STAGING}").fetchone()
+    conn.commit()
+    if old_count != new_count:
+        raise RuntimeError(
+            f"Row count mismatch ({old_count} vs {new_count}), measurements left unchanged"
+        )
+
+    conn.execute("BEGIN IMMEDIATE")
+    for trigger in TRIGGERS:
+        conn.execute(f"DROP TRIGGER {trigger}")
+    conn.execute("ALTER TABLE measurements RENAME TO measurements_old")
+    conn.execute(f"ALTER TABLE {STAGING} RENAME TO measurements")
+    conn.commit()
+    logging.info(f"Swapped in the clustered table ({new_count} rows)")
+
+
+def drop_old(conn: sqlite3.Connection, batch_size: int, pause: float) -> None:
+    # Dropping a large table in one go would hold the write lock while every
+    # page is freed, so empty it in batches first.
+    while True:
+        deleted = conn.execute(
+            """
+            DELETE FROM measurements_old
+            WHERE id IN (SELECT id FROM measurements_old ORDER BY id LIMIT ?)
+            """,
+            (batch_size,),
+        ).rowcount
+        conn.commit()
+        if not deleted:
+            break
+        time.sleep(pause)
+
+    conn.execute("DROP TABLE measurements_old")
+    conn.commit()
+    logging.info("Dropped the old measurements table")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert measurements to the clustered layout online")
+    parser.add_argument("--db", default=SQLITE_DB, help="SQLite database (default: $SQLITE_DB)")
+    parser.add_argument("--batch-size", type=int, default=10000, help="rows per transaction")
+    parser.add_argument("--pause", type=float, default=0.05, help="seconds between batches")
+    parser.add_argument("--keep-old", action="store_true", help="keep the old table as measurements_old")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(args.db, timeout=60)
+    init_db(conn)
+
+    if is_clustered(conn):
+        if conn.execute(
+            "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'measurements_old'"
+        ).fetchone() and not args.keep_old:
+            drop_old(conn, args.batch_size, args.pause)
+        logging.info("measurements already uses the clustered layout")
+        return
+
+    t0 = time.perf_counter()
+    last_id = prepare(conn)
+    copy_rows(conn, last_id, args.batch_size, args.pause)
+    swap(conn)
+    if not args.keep_old:
+        drop_old(conn, args.batch_size, args.pause)
+    conn.close()
+    logging.info(f"Migration finished in {time.perf_counter() - t0:.1f}s")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+import asyncio
+import json
+import logging
+import socket
+from typing import Any, Dict, Optional, Set
+
+# ----------------------------
+# Local ingest -> web server notification channel
+# ----------------------------
+#
+# main.py sends one UDP datagram to 127.0.0.1 per committed measurement and
+# web_server.py fans it out to every connected dashboard stream. Delivery is
+# best effort: a lost datagram only means a tab misses one point until its
+# next catch-up fetch, and ingest never waits on the web server.
+#
+# Anything on the host can send to the port, so datagrams are checked for the
+# shape the stream needs and their contents are not trusted for anything else.
+
+# Fields of the device_state row in a notification that the stream reads.
+DEVICE_FIELDS = {
+    "device_id": str,
+    "last_seen": int,
+    "message_count": int,
+    "window_start": int,
+    "window_count": int,
+    "prev_window_count": int,
+}
+
+
+def is_measurement(message: Any) -> bool:
+    """True for {"event": "measurement", "data": {"reading": {...}, "device": {...}}} as main.py sends it."""
+    if not isinstance(message, dict) or message.get("event") != "measurement":
+        return False
+    data = message.get("data")
+    if not isinstance(data, dict):
+        return False
+    reading, device = data.get("reading"), data.get("device")
+    if not isinstance(reading, dict) or not isinstance(device, dict):
+        return False
+    if not isinstance(reading.get("id"), int) or not isinstance(reading.get("device_id"), str):
+        return False
+    if not all(isinstance(device.get(field), kind) for field, kind in DEVICE_FIELDS.items()):
+        return False
+    return device.get("rssi_avg") is None or isinstance(device["rssi_avg"], (int, float))
+
+
+class Notifier:
+    """Fire-and-forget sender used by the ingest process."""
+
+    def __init__(self, host: str, port: int):
+        self.address = (host, port)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setblocking(False)
+
+    def send(self, event: str, data: Dict[str, Any]) -> None:
+        message = json.dumps({"event": event, "data": data}, separators=(",", ":"))
+        try:
+            self.sock.sendto(message.encode("utf-8"), self.address)
+        except OSError:
+            # Nobody listening or socket buffer full, drop it.
+            pass
+
+    def close(self) -> None:
+        self.sock.close()
+
+
+class NotificationHub(asyncio.DatagramProtocol):
+    """
+    Receives ingest notifications on the web server's event loop and copies
+    them into one bounded queue per subscriber.
+    """
+
+    def __init__(self, queue_size: int = 256):
+        self.queue_size = queue_size
+        self.subscribers: Set[asyncio.Queue] = set()
+        self.transport: Optional[asyncio.DatagramTransport] = None
+        # Measurement notifications received. Only tells the web server that
+        # data changed; the ids in them are not trusted.
+        self.changes = 0
+
+    async def start(self, host: str, port: int) -> None:
+        loop = asyncio.get_running_loop()
+        self.transport, _ = await loop.create_datagram_endpoint(
+            lambda: self, local_addr=(host, port)
+        )
+
+    def close(self) -> None:
+        if self.transport is not None:
+            self.transport.close()
+        for queue in list(self.subscribers):
+            self._evict(queue)
+
+    def subscribe(self) -> asyncio.Queue:
+        queue: asyncio.Queue = asyncio.Queue(maxsize=self.queue_size)
+        self.subscribers.add(queue)
+        return queue
+
+    def unsubscribe(self, queue: asyncio.Queue) -> None:
+        self.subscribers.discard(queue)
+
+    def datagram_received(self, data: bytes, addr) -> None:
+        try:
+            message = json.loads(data)
+        except ValueError:
+            message = None
+        if not is_measurement(message):
+            logging.debug(f"Dropping malformed notification from {addr}")
+            return
+        self.changes += 1
+
+        for queue in list(self.subscribers):
+            try:
+                queue.put_nowait(message)
+            except asyncio.QueueFull:
+                # The client stopped reading. Cut it loose; the dashboard
+                # falls back to polling and reconnects with a fresh queue.
+                self._evict(queue)
+
+    def _evict(self, queue: asyncio.Queue) -> None:
+        """Drop a subscriber and wake its stream with the end marker."""
+        self.subscribers.discard(queue)
+        while not queue.empty():
+            queue.get_nowait()
+        queue.put_nowait(None)
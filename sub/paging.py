@@ -0,0 +1,132 @@
+import base64
+import binascii
+import json
+from typing import Any, Dict, List, Optional, Tuple
+
+# ----------------------------
+# Keyset pagination of measurement rows
+# ----------------------------
+#
+# Pages of /api/data/history are ordered by (timestamp_server, id), which is
+# unique, and each page starts right after the last key of the previous one:
+#
+#   WHERE ... AND (timestamp_server, id) < (:last_ts, :last_id)
+#   ORDER BY timestamp_server DESC, id DESC LIMIT :limit
+#
+# That is an index seek (the primary key for one device, idx_measurements_time
+# across devices), so a page costs the same at any depth; OFFSET would read
+# and discard every row before it.
+#
+# The continuation token carries the last key together with the query it
+# belongs to (device, time range, quality filter, order), so the following
+# pages only need the token. Tokens are URL-safe base64 of compact JSON:
+# opaque to clients, and harmless if tampered with, since every value is
+# validated and bound as a parameter.
+
+ORDERS = ("desc", "asc")
+
+# Largest value SQLite stores as an integer; time bounds are kept within it.
+MAX_INT = 2**63 - 1
+
+
+class InvalidCursor(ValueError):
+    pass
+
+
+class PageQuery:
+    """A history query that can be resumed: filters plus the last key seen."""
+
+    __slots__ = ("device_id", "start", "end", "quality", "order", "after")
+
+    def __init__(
+        self,
+        device_id: Optional[str],
+        start: Optional[int],
+        end: Optional[int],
+        quality: str,
+        order: str,
+        after: Optional[Tuple[int, int]] = None,
+    ):
+        self.device_id = device_id
+        self.start = start
+        self.end = end
+        self.quality = quality
+        self.order = order
+        self.after = after
+
+    def sql(self, columns: str, quality_condition: Optional[str], limit: int) -> Tuple[str, List[Any]]:
+        """SELECT for one page of at most `limit` rows."""
+        conditions: List[str] = []
+        params: List[Any] = []
+        if self.device_id:
+            conditions.append("device_id = ?")
+            params.append(self.device_id)
+        # Past the first page the last key replaces the range bound on the side
+        # pages move away from. It is also spelled out as a plain bound on
+        # timestamp_server: the planner seeks on that one but not on the row
+        # value after device_id = ?, which would rescan from the range start.
+        descending = self.order == "desc"
+        if self.start is not None and (descending or self.after is None):
+            conditions.append("timestamp_server >= ?")
+            params.append(self.start)
+        if self.end is not None and (not descending or self.after is None):
+            conditions.append("timestamp_server < ?")
+            params.append(self.end)
+        if self.after is not None:
+            last_ts, last_id = self.after
+            op = "<" if descending else ">"
+            conditions.append(f"timestamp_server {op}= ? AND (timestamp_server, id) {op} (?, ?)")
+            params.extend((last_ts, last_ts, last_id))
+        if quality_condition:
+            conditions.append(quality_condition)
+
+        where = f"WHERE {' AND '.join(conditions)}" if conditions else ""
+        direction = self.order.upper()
+        query = f"""
+            SELECT {columns}
+            FROM measurements
+            {where}
+            ORDER BY timestamp_server {direction}, id {direction}
+            LIMIT ?
+        """
+        params.append(limit)
+        return query, params
+
+    def token(self, last: Tuple[int, int]) -> str:
+        """Continuation token for the page after the row with key `last`."""
+        state = {
+            "d": self.device_id,
+            "s": self.start,
+            "e": self.end,
+            "q": self.quality,
+            "o": self.order,
+            "k": list(last),
+        }
+        raw = json.dumps(state, separators=(",", ":")).encode("utf-8")
+        return base64.urlsafe_b64encode(raw).rstrip(b"=").decode("ascii")
+
+    @classmethod
+    def from_token(cls, token: str, qualities) -> "PageQuery":
+        try:
+            raw = base64.urlsafe_b64decode(token + "=" * (-len(token) % 4))
+            state: Dict[str, Any] = json.loads(raw)
+            device_id, start, end = state["d"], state["s"], state["e"]
+            quality, order, (last_ts, last_id) = state["q"], state["o"], state["k"]
+        except (binascii.Error, UnicodeDecodeError, ValueError, KeyError, TypeError):
+            raise InvalidCursor("Invalid cursor")
+
+        if not (
+            (device_id is None or isinstance(device_id, str))
+            and all(v is None or _is_int(v) for v in (start, end))
+            and _is_int(last_ts)
+            and _is_int(last_id)
+            and isinstance(quality, str)
+            and quality in qualities
+            and order in ORDERS
+        ):
+            raise InvalidCursor("Invalid cursor")
+        return cls(device_id, start, end, quality, order, (last_ts, last_id))
+
+
+def _is_int(value: Any) -> bool:
+    return isinstance(value, int) and not isinstance(value, bool) and -MAX_INT <= value <= MAX_INT
@@ -0,0 +1,236 @@
+import argparse
+import logging
+import os
+import sqlite3
+import time
+from collections import deque
+from statistics import median
+from typing import Any, Deque, Dict, Iterable, Tuple
+
+from dotenv import load_dotenv
+
+from downsample import VALID_RANGES
+
+# ----------------------------
+# Streaming quality checks at ingest
+# ----------------------------
+#
+# Every stored measurement carries a `quality` bitmask, 0 for a clean row.
+# The low bits say which fields are suspect, the high bits why:
+#
+#   bit 0-6   dht22_temperature_c, dht22_humidity_percent, bmp280_temperature_c,
+#             bmp280_pressure_pa, altitude_m, rssi, free_heap
+#   bit 8     SENTINEL  -999, what the firmware reports for a failed sensor read
+#   bit 9     RANGE     outside the field's plausible range (VALID_RANGES)
+#   bit 10    SPIKE     Hampel filter: further than HAMPEL_THRESHOLD scaled MADs
+#                       from the median of the device's last HAMPEL_WINDOW values
+#
+# The values themselves are stored unchanged. Readers skip a field with
+# `quality & <field bit>`, whole rows with `quality = 0`.
+
+QUALITY_FIELDS = (
+    "dht22_temperature_c",
+    "dht22_humidity_percent",
+    "bmp280_temperature_c",
+    "bmp280_pressure_pa",
+    "altitude_m",
+    "rssi",
+    "free_heap",
+)
+FIELD_BITS = {field: 1 << i for i, field in enumerate(QUALITY_FIELDS)}
+
+SENTINEL = 1 << 8
+RANGE = 1 << 9
+SPIKE = 1 << 10
+
+SENTINEL_VALUE = -999.0
+
+# altitude_m is computed on the node from the pressure reading.
+DERIVED_FROM = {"altitude_m": "bmp280_pressure_pa"}
+
+HAMPEL_WINDOW = 15
+HAMPEL_MIN_SAMPLES = 5
+HAMPEL_THRESHOLD = 3.0
+MAD_TO_SIGMA = 1.4826
+
+# Only physical readings go through the Hampel filter; heap and RSSI jump by
+# design. The floor keeps a sensor that sits on one value (MAD 0) from having
+# its next small step flagged: roughly the sensor's noise.
+HAMPEL_MIN_SCALE = {
+    "dht22_temperature_c": 0.5,
+    "dht22_humidity_percent": 2.0,
+    "bmp280_temperature_c": 0.5,
+    "bmp280_pressure_pa": 30.0,
+}
+
+
+def field_flagged(quality: int, field: str) -> bool:
+    return bool(quality & FIELD_BITS.get(field, 0))
+
+
+def good_value_sql(field: str) -> str:
+    """SQL expression for a field's value, NULL where it is flagged."""
+    if field not in FIELD_BITS:
+        # Derived fields have no bit; they are stored as NULL when an input is flagged.
+        return field
+    return f"CASE WHEN quality & {FIELD_BITS[field]} THEN NULL ELSE {field} END"
+
+
+def is_number(value: Any) -> bool:
+    return isinstance(value, (int, float)) and not isinstance(value, bool)
+
+
+class QualityDetector:
+    """
+    Per-device checks for a stream of measurements, fed in arrival order.
+    Holds the last HAMPEL_WINDOW values of each filtered field per device.
+    """
+
+    def __init__(self, window: int = HAMPEL_WINDOW, threshold: float = HAMPEL_THRESHOLD):
+        self.window = window
+        self.threshold = threshold
+        self.history: Dict[Tuple[str, str], Deque[float]] = {}
+
+    def check(self, measurement: Dict[str, Any]) -> int:
+        """Return the quality bitmask of a measurement and remember its values."""
+        quality = 0
+        device_id = measurement["device_id"]
+        for field, bit in FIELD_BITS.items():
+            value = measurement.get(field)
+            if not is_number(value):
+                # Missing, or a wrong type the insert will reject anyway.
+                continue
+            reason = self._check_field(device_id, field, value)
+            source = DERIVED_FROM.get(field)
+            if not reason and source and measurement.get(source) == SENTINEL_VALUE:
+                reason = SENTINEL
+            if reason:
+                quality |= bit | reason
+        return quality
+
+    def _check_field(self, device_id: str, field: str, value: float) -> int:
+        if value == SENTINEL_VALUE:
+            return SENTINEL
+        low, high = VALID_RANGES[field]
+        if not low <= value <= high:
+            return RANGE
+
+        min_scale = HAMPEL_MIN_SCALE.get(field)
+        if min_scale is None:
+            return 0
+
+        recent = self.history.get((device_id, field))
+        if recent is None:
+            recent = self.history[(device_id, field)] = deque(maxlen=self.window)
+
+        reason = 0
+        if len(recent) >= HAMPEL_MIN_SAMPLES:
+            center = median(recent)
+            mad = median(abs(v - center) for v in recent)
+            if abs(value - center) > self.threshold * max(MAD_TO_SIGMA * mad, min_scale):
+                reason = SPIKE
+        # Spikes stay in the window: the median ignores them, and a real step
+        # change is accepted once it fills half the window.
+        recent.append(value)
+        return reason
+
+    def warm(self, conn: sqlite3.Connection) -> None:
+        """Fill the windows from each device's latest stored rows, e.g. after a restart."""
+        columns = ", ".join(HAMPEL_MIN_SCALE)
+        devices = [row[0] for row in conn.execute("SELECT device_id FROM device_state")]
+        for device_id in devices:
+            rows = conn.execute(
+                f"""
+                SELECT {columns}
+                FROM measurements
+                WHERE device_id = ?
+                ORDER BY timestamp_server DESC, id DESC
+                LIMIT ?
+                """,
+                (device_id, self.window),
+            ).fetchall()
+            for row in reversed(rows):
+                self.check({"device_id": device_id, **dict(zip(HAMPEL_MIN_SCALE, row))})
+
+
+# ----------------------------
+# Backfill of stored rows
+# ----------------------------
+#
+# Rows stored before the quality column existed read as clean (0). This
+# replays each device's history through the detector in time order and writes
+# the flags in short transactions, so ingest can keep running.
+
+load_dotenv()
+
+SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+
+
+def device_rows(conn: sqlite3.Connection, device_id: str, batch_size: int) -> Iterable[list]:
+    columns = ", ".join(QUALITY_FIELDS)
+    last = (-1, -1)
+    while True:
+        batch = conn.execute(
+            f"""
+            SELECT timestamp_server, id, {columns}
+            FROM measurements
+            WHERE device_id = ? AND (timestamp_server, id) > (?, ?)
+            ORDER BY timestamp_server, id
+            LIMIT ?
+            """,
+            (device_id, *last, batch_size),
+        ).fetchall()
+        if not batch:
+            return
+        yield batch
+        last = batch[-1][:2]
+
+
+def backfill(conn: sqlite3.Connection, batch_size: int, pause: float) -> int:
+    detector = QualityDetector()
+    devices = [row[0] for row in conn.execute("SELECT device_id FROM device_state")]
+    flagged = 0
+    for device_id in devices:
+        for batch in device_rows(conn, device_id, batch_size):
+            updates = []
+            for ts, row_id, *values in batch:
+                quality = detector.check({"device_id": device_id, **dict(zip(QUALITY_FIELDS, values))})
+                updates.append((quality, device_id, ts, row_id))
+            conn.executemany(
+                """
+                UPDATE measurements SET quality = ?
+                WHERE device_id = ? AND timestamp_server = ? AND id = ?
+                """,
+                updates,
+            )
+            conn.commit()
+            flagged += sum(1 for quality, *_ in updates if quality)
+            time.sleep(pause)
+        logging.info(f"Checked {device_id}, {flagged} rows flagged so far")
+    return flagged
+
+
+def main():
+    from storage import init_db, rebuild_device_stats
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
+
+    parser = argparse.ArgumentParser(description="Compute quality flags for stored measurements")
+    parser.add_argument("--db", default=SQLITE_DB, help="SQLite database (default: $SQLITE_DB)")
+    parser.add_argument("--batch-size", type=int, default=5000, help="rows per transaction")
+    parser.add_argument("--pause", type=float, default=0.01, help="seconds between batches")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(args.db, timeout=60)
+    init_db(conn)
+
+    t0 = time.perf_counter()
+    flagged = backfill(conn, args.batch_size, args.pause)
+    # Running aggregates leave flagged values out, as ingest does.
+    rebuild_device_stats(conn)
+    conn.close()
+    logging.info(f"Flagged {flagged} rows in {time.perf_counter() - t0:.1f}s")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,47 @@
+import argparse
+import logging
+import os
+import sqlite3
+import time
+
+from dotenv import load_dotenv
+
+from storage import init_db, rebuild_device_state, rebuild_device_stats
+
+# ----------------------------
+# Recompute ingest-maintained tables from raw measurements
+# ----------------------------
+#
+# device_state and device_stats are updated incrementally by main.py. Run this
+# after importing or deleting rows by hand, or if they are ever suspected to
+# have drifted. The rebuild holds the write lock, so ingest pauses for its
+# duration.
+
+load_dotenv()
+
+SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+
+logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Rebuild device_state and device_stats")
+    parser.add_argument("--db", default=SQLITE_DB, help="SQLite database (default: $SQLITE_DB)")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(args.db, timeout=60)
+    init_db(conn)
+
+    t0 = time.perf_counter()
+    rebuild_device_state(conn)
+    logging.info(f"device_state rebuilt in {time.perf_counter() - t0:.2f}s")
+
+    t0 = time.perf_counter()
+    rebuild_device_stats(conn)
+    logging.info(f"device_stats rebuilt in {time.perf_counter() - t0:.2f}s")
+
+    conn.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,177 @@
+// Chart data worker: fetches and decodes history, derives the heap series,
+// and turns live rows into per-chart patches, so the page's main thread only
+// hands finished points to Chart.js.
+//
+// Messages in (processed one at a time, in order):
+//   {type: 'load', generation, url, hours, device, chartFields}
+//   {type: 'append', generation, rows}
+//   {type: 'fetch-append', generation, url}
+// Messages out:
+//   {type: 'loaded', generation, devices, charts: {chartId: {deviceId: {x, y}}}}
+//   {type: 'patch', generation, devices, charts: {chartId: {deviceId: {drop, x, y}}}}
+//   {type: 'error', generation, message}
+//
+// x is in milliseconds. The worker keeps a copy of every series exactly as
+// the page's datasets hold it, so a patch can say how many points to drop
+// from the front (older than the time range) and which to append.
+
+// ESP32 WROOM-32 total heap, ~320KB; the heap chart shows used heap in %
+const ESP32_TOTAL_HEAP = 327680;
+
+// Field bits of the quality mask set at ingest (same order as quality.py)
+const QUALITY_BITS = {
+    'dht22_temperature_c': 1 << 0,
+    'dht22_humidity_percent': 1 << 1,
+    'bmp280_temperature_c': 1 << 2,
+    'bmp280_pressure_pa': 1 << 3,
+    'altitude_m': 1 << 4,
+    'rssi': 1 << 5,
+    'free_heap': 1 << 6
+};
+
+let view = null; // {generation, hours, device, chartFields, devices, series}
+let queue = Promise.resolve();
+
+self.onmessage = (e) => {
+    const msg = e.data;
+    queue = queue
+        .then(() => handle(msg))
+        .catch(error => self.postMessage({
+            type: 'error',
+            generation: msg.generation,
+            message: String(error)
+        }));
+};
+
+async function handle(msg) {
+    if (msg.type === 'load') {
+        await load(msg);
+    } else if (msg.type === 'append') {
+        append(msg.rows, msg.generation);
+    } else if (msg.type === 'fetch-append') {
+        const response = await fetch(msg.url);
+        const data = await response.json();
+        append(data.data, msg.generation);
+    }
+}
+
+// Whether ingest flagged this field of the row (sentinel, range or spike)
+function isFlagged(row, field) {
+    return Boolean((row.quality || 0) & (QUALITY_BITS[field] || 0));
+}
+
+function chartValue(chartId, value) {
+    return chartId === 'heap-chart' ? ((ESP32_TOTAL_HEAP - value) / ESP32_TOTAL_HEAP) * 100 : value;
+}
+
+function lowerBound(xs, target, lo, hi) {
+    while (lo < hi) {
+        const mid = (lo + hi) >> 1;
+        if (xs[mid] < target) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+async function load(msg) {
+    const response = await fetch(msg.url);
+    const data = await response.json();
+
+    const devices = Object.keys(data.series);
+    const series = {};
+    Object.keys(msg.chartFields).forEach(chartId => { series[chartId] = {}; });
+
+    devices.forEach(deviceId => {
+        Object.entries(msg.chartFields).forEach(([chartId, field]) => {
+            // Columns -> x/y arrays, undoing the delta encoding
+            const { t, v } = data.series[deviceId][field] || { t: [], v: [] };
+            const x = new Array(t.length);
+            const y = new Array(t.length);
+            let ts = 0;
+            for (let i = 0; i < t.length; i++) {
+                ts += t[i];
+                x[i] = ts * 1000;
+                y[i] = chartValue(chartId, v[i]);
+            }
+            series[chartId][deviceId] = { x, y };
+        });
+    });
+
+    view = {
+        generation: msg.generation,
+        hours: msg.hours,
+        device: msg.device,
+        chartFields: msg.chartFields,
+        devices,
+        series
+    };
+
+    // Typed copies are transferred, not cloned; the arrays stay here.
+    const charts = {};
+    const transfer = [];
+    Object.entries(series).forEach(([chartId, byDevice]) => {
+        charts[chartId] = {};
+        Object.entries(byDevice).forEach(([deviceId, { x, y }]) => {
+            const out = { x: Float64Array.from(x), y: Float64Array.from(y) };
+            charts[chartId][deviceId] = out;
+            transfer.push(out.x.buffer, out.y.buffer);
+        });
+    });
+    self.postMessage({ type: 'loaded', generation: msg.generation, devices, charts }, transfer);
+}
+
+function append(rows, generation) {
+    if (!view || generation !== view.generation || !rows || rows.length === 0) return;
+
+    const patch = {};
+    const addPoint = (chartId, deviceId, x, y) => {
+        const byDevice = view.series[chartId];
+        let points = byDevice[deviceId];
+        if (!points) {
+            points = byDevice[deviceId] = { x: [], y: [] };
+        }
+        // Live rows arrive in order; anything older than the newest point
+        // (a duplicate, or a late arrival) waits for the next full load.
+        if (points.x.length && x <= points.x[points.x.length - 1]) return false;
+        points.x.push(x);
+        points.y.push(y);
+
+        const chartPatch = patch[chartId] || (patch[chartId] = {});
+        const out = chartPatch[deviceId] || (chartPatch[deviceId] = { drop: 0, x: [], y: [] });
+        out.x.push(x);
+        out.y.push(y);
+        return true;
+    };
+
+    rows.slice()
+        .sort((a, b) => a.timestamp_server - b.timestamp_server)
+        .forEach(row => {
+            const deviceId = row.device_id;
+            if (view.device && deviceId !== view.device) return;
+            if (!view.devices.includes(deviceId)) view.devices.push(deviceId);
+
+            const x = row.timestamp_server * 1000;
+            Object.entries(view.chartFields).forEach(([chartId, field]) => {
+                const value = row[field];
+                if (value === null || value === undefined || isFlagged(row, field)) return;
+                addPoint(chartId, deviceId, x, chartValue(chartId, value));
+            });
+        });
+
+    // Drop points that left the time range from the series just extended
+    const cutoff = Date.now() - view.hours * 3600 * 1000;
+    Object.entries(patch).forEach(([chartId, byDevice]) => {
+        Object.entries(byDevice).forEach(([deviceId, out]) => {
+            const points = view.series[chartId][deviceId];
+            const drop = lowerBound(points.x, cutoff + 1, 0, points.x.length);
+            if (drop > 0) {
+                points.x.splice(0, drop);
+                points.y.splice(0, drop);
+                out.drop = drop;
+            }
+        });
+    });
+
+    if (Object.keys(patch).length > 0) {
+        self.postMessage({ type: 'patch', generation, devices: view.devices, charts: patch });
+    }
+}
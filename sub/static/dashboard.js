@@ -6,8 +6,20 @@ let selectedDevice = '';
 let selectedTimeRange = 24;
 let refreshTimer = null;
 let lastSeenTimer = null;
+let liveStream = null; // EventSource for pushed updates
 let deviceStatusCache = {}; // Cache device status for client-side updates
+let statsCache = null; // Last /api/stats overall block, bumped by pushed rows
 let dht22Visible = false; // DHT22 data hidden by default
+let chartWorker = null; // Web Worker preparing chart data (chart_worker.js)
+let chartGeneration = 0; // Bumped on every full chart load; older results are ignored
+let pendingChartRows = []; // Live rows waiting for the next animation frame
+
+// Fingerprinted URL of chart_worker.js, set by the page template
+const CHART_WORKER_URL = document.currentScript.dataset.worker;
+
+// Frame timing and main-thread blocking, enabled with ?perf=1
+const PERF_ENABLED = new URLSearchParams(window.location.search).has('perf');
+const perfStats = { frames: [], longTasks: [], chartWork: [] };
 
 // Initialize dashboard
 document.addEventListener('DOMContentLoaded', () => {
@@ -30,6 +42,11 @@ document.addEventListener('DOMContentLoaded', () => {
     }
     updateDht22ToggleButton();
     
+    if (PERF_ENABLED) {
+        startPerfMonitor();
+    }
+    startChartWorker();
+    
     // Setup event listeners
     document.getElementById('device-filter').addEventListener('change', handleDeviceFilterChange);
     document.getElementById('time-range').addEventListener('change', handleTimeRangeChange);
@@ -41,8 +58,8 @@ document.addEventListener('DOMContentLoaded', () => {
     // Initial load
     refreshAllData();
     
-    // Auto-refresh (only data, not rendering)
-    startAutoRefresh();
+    // Pushed updates; polling only runs while the stream is down
+    startLiveUpdates();
     
     // Start client-side last seen timer
     startLastSeenTimer();
@@ -59,6 +76,58 @@ function startAutoRefresh() {
     }, REFRESH_INTERVAL);
 }
 
+function stopAutoRefresh() {
+    if (refreshTimer) {
+        clearInterval(refreshTimer);
+        refreshTimer = null;
+    }
+}
+
+// Live updates from /api/stream (server-sent events)
+function startLiveUpdates() {
+    if (!window.EventSource) {
+        startAutoRefresh();
+        return;
+    }
+    
+    liveStream = new EventSource('/api/stream');
+    
+    liveStream.onopen = () => {
+        console.log('Live stream connected, polling stopped');
+        stopAutoRefresh();
+        // Catch up on anything missed while disconnected
+        updateDataInBackground();
+    };
+    
+    liveStream.onerror = () => {
+        // EventSource reconnects on its own; poll until it does
+        if (!refreshTimer) {
+            console.log('Live stream disconnected, falling back to polling');
+            startAutoRefresh();
+        }
+    };
+    
+    liveStream.addEventListener('measurement', (e) => {
+        const row = JSON.parse(e.data);
+        prependLatestRows([row]);
+        appendRowsToCharts([row]);
+        bumpStatistics(row);
+    });
+    
+    liveStream.addEventListener('device', (e) => {
+        const device = JSON.parse(e.data);
+        const isNew = !deviceStatusCache[device.device_id];
+        deviceStatusCache[device.device_id] = device;
+        
+        if (isNew) {
+            loadDeviceStatus();
+            loadStatistics();
+        } else {
+            updateDeviceCard(device);
+        }
+    });
+}
+
 // Client-side last seen timer
 function startLastSeenTimer() {
     if (lastSeenTimer) {
@@ -319,21 +388,7 @@ async function loadLatestData() {
                         </tr>
                     </thead>
                     <tbody id="latest-data-tbody">
-                        ${data.data.map(row => {
-                            const heapPercent = row.free_heap ? (((327680 - row.free_heap) / 327680) * 100).toFixed(1) : null;
-                            return `
-                            <tr data-timestamp="${row.timestamp_server}">
-                                <td>${row.device_id}</td>
-                                <td>${formatTimestamp(row.timestamp_server)}</td>
-                                <td class="dht22-data">${formatValue(row.dht22_temperature_c, 1)}</td>
-                                <td class="dht22-data">${formatValue(row.dht22_humidity_percent, 1)}</td>
-                                <td>${formatValue(row.bmp280_temperature_c, 1)}</td>
-                                <td>${formatValue(row.bmp280_pressure_pa, 0)}</td>
-                                <td>${formatValue(row.altitude_m, 1)}</td>
-                                <td>${heapPercent ? heapPercent + '% (' + ((327680 - row.free_heap) / 1024).toFixed(0) + 'KB)' : 'N/A'}</td>
-                                <td>${formatValue(row.rssi, 0)}</td>
-                            </tr>`;
-                        }).join('')}
+                        ${data.data.map(renderLatestRow).join('')}
                     </tbody>
                 </table>
             </div>
@@ -346,6 +401,46 @@ async function loadLatestData() {
     }
 }
 
+// Render one row of the latest measurements table
+function renderLatestRow(row) {
+    const heapPercent = row.free_heap ? (((327680 - row.free_heap) / 327680) * 100).toFixed(1) : null;
+    return `
+    <tr data-timestamp="${row.timestamp_server}" data-id="${row.id}">
+        <td>${row.device_id}</td>
+        <td>${formatTimestamp(row.timestamp_server)}</td>
+        <td class="dht22-data">${formatValue(row.dht22_temperature_c, 1)}</td>
+        <td class="dht22-data">${formatValue(row.dht22_humidity_percent, 1)}</td>
+        <td>${formatValue(row.bmp280_temperature_c, 1)}</td>
+        <td>${formatValue(row.bmp280_pressure_pa, 0)}</td>
+        <td>${formatValue(row.altitude_m, 1)}</td>
+        <td>${heapPercent ? heapPercent + '% (' + ((327680 - row.free_heap) / 1024).toFixed(0) + 'KB)' : 'N/A'}</td>
+        <td>${formatValue(row.rssi, 0)}</td>
+    </tr>`;
+}
+
+// Prepend rows newer than the table's first row, keeping the last 20
+function prependLatestRows(rows) {
+    const tbody = document.getElementById('latest-data-tbody');
+    if (!tbody) return;
+    
+    // Get the most recent timestamp in the table
+    const firstRow = tbody.querySelector('tr');
+    const latestTimestamp = firstRow ? parseInt(firstRow.dataset.timestamp) : 0;
+    
+    // Filter only new data
+    const newData = rows.filter(row => row.timestamp_server >= latestTimestamp &&
+        !tbody.querySelector(`tr[data-id="${row.id}"]`));
+    if (newData.length === 0) return;
+    
+    tbody.insertAdjacentHTML('afterbegin', newData.map(renderLatestRow).join(''));
+    
+    // Keep only last 20 rows
+    const allRows = tbody.querySelectorAll('tr');
+    for (let i = 20; i < allRows.length; i++) {
+        allRows[i].remove();
+    }
+}
+
 // Update latest data table (only prepend new rows)
 async function updateLatestDataTable() {
     try {
@@ -356,321 +451,242 @@ async function updateLatestDataTable() {
             return;
         }
         
-        // Get the most recent timestamp in the table
-        const firstRow = tbody.querySelector('tr');
-        const latestTimestamp = firstRow ? parseInt(firstRow.dataset.timestamp) : 0;
-        
         const response = await fetch('/api/data/latest?limit=5');
         const data = await response.json();
         
-        // Filter only new data
-        const newData = data.data.filter(row => row.timestamp_server > latestTimestamp);
-        
-        if (newData.length > 0) {
-            // Prepend new rows
-            const newRows = newData.map(row => {
-                const heapPercent = row.free_heap ? (((327680 - row.free_heap) / 327680) * 100).toFixed(1) : null;
-                return `
-                <tr data-timestamp="${row.timestamp_server}">
-                    <td>${row.device_id}</td>
-                    <td>${formatTimestamp(row.timestamp_server)}</td>
-                    <td class="dht22-data">${formatValue(row.dht22_temperature_c, 1)}</td>
-                    <td class="dht22-data">${formatValue(row.dht22_humidity_percent, 1)}</td>
-                    <td>${formatValue(row.bmp280_temperature_c, 1)}</td>
-                    <td>${formatValue(row.bmp280_pressure_pa, 0)}</td>
-                    <td>${formatValue(row.altitude_m, 1)}</td>
-                    <td>${heapPercent ? heapPercent + '% (' + ((327680 - row.free_heap) / 1024).toFixed(0) + 'KB)' : 'N/A'}</td>
-                    <td>${formatValue(row.rssi, 0)}</td>
-                </tr>`;
-            }).join('');
-            
-            tbody.insertAdjacentHTML('afterbegin', newRows);
-            
-            // Keep only last 20 rows
-            const allRows = tbody.querySelectorAll('tr');
-            if (allRows.length > 20) {
-                for (let i = 20; i < allRows.length; i++) {
-                    allRows[i].remove();
-                }
-            }
-        }
+        prependLatestRows(data.data);
     } catch (error) {
         console.error('Error updating latest data:', error);
     }
 }
 
-// Load historical data and render charts (full render)
-async function loadHistoricalData() {
-    try {
-        const params = new URLSearchParams({
-            hours: selectedTimeRange,
-            limit: 1000
-        });
+// Chart data worker
+function startChartWorker() {
+    chartWorker = new Worker(CHART_WORKER_URL);
+    chartWorker.onmessage = (e) => {
+        const msg = e.data;
+        // Results for a time range or device filter that is no longer shown
+        if (msg.generation !== chartGeneration) return;
         
-        if (selectedDevice) {
-            params.append('device_id', selectedDevice);
+        const started = performance.now();
+        if (msg.type === 'loaded') {
+            renderCharts(msg);
+        } else if (msg.type === 'patch') {
+            applyChartPatch(msg);
+        } else if (msg.type === 'error') {
+            console.error('Error loading chart data:', msg.message);
         }
-        
-        const response = await fetch(`/api/data/history?${params}`);
-        const data = await response.json();
-        
-        if (data.data.length === 0) {
-            console.log('No historical data available');
-            return;
+        if (PERF_ENABLED) {
+            perfStats.chartWork.push(performance.now() - started);
         }
-        
-        // Group data by device
-        const deviceData = {};
-        data.data.forEach(row => {
-            if (!deviceData[row.device_id]) {
-                deviceData[row.device_id] = [];
-            }
-            deviceData[row.device_id].push(row);
-        });
-        
-        // Prepare datasets for charts
-        const datasets = Object.entries(deviceData).map(([deviceId, rows], index) => {
-            const colors = [
-                'rgb(255, 99, 132)',
-                'rgb(54, 162, 235)',
-                'rgb(255, 206, 86)',
-                'rgb(75, 192, 192)',
-                'rgb(153, 102, 255)',
-                'rgb(255, 159, 64)'
-            ];
-            const color = colors[index % colors.length];
-            
-            // Sort by timestamp
-            rows.sort((a, b) => a.timestamp_server - b.timestamp_server);
-            
-            return {
-                deviceId,
-                color,
-                rows
-            };
-        });
-        
-        // Create/update charts
-        renderChart('temp-chart-dht22', 'DHT22 Temperature (°C)', datasets, 'dht22_temperature_c');
-        renderChart('temp-chart-bmp280', 'BMP280 Temperature (°C)', datasets, 'bmp280_temperature_c');
-        renderChart('humidity-chart', 'Humidity (%)', datasets, 'dht22_humidity_percent');
-        renderChart('pressure-chart', 'Pressure (Pa)', datasets, 'bmp280_pressure_pa');
-        renderChart('altitude-chart', 'Altitude (m)', datasets, 'altitude_m');
-        renderHeapChart('heap-chart', datasets);
-        renderChart('rssi-chart', 'RSSI (dBm)', datasets, 'rssi');
-        
-        // Render pressure trend chart (calculated from pressure data)
-        renderPressureTrendChart('pressure-trend-chart', datasets);
-        
-    } catch (error) {
-        console.error('Error loading historical data:', error);
+    };
+}
+
+// Load historical data and render charts (full render)
+async function loadHistoricalData() {
+    // Server filters outliers and downsamples to about one point per
+    // horizontal pixel, whatever the time range
+    const params = new URLSearchParams({
+        hours: selectedTimeRange,
+        points: chartPointBudget(),
+        fields: Object.values(CHART_FIELDS).join(','),
+        // {t: [...], v: [...]} per series, timestamps as differences
+        format: 'columnar',
+        delta: 'true'
+    });
+    
+    if (selectedDevice) {
+        params.append('device_id', selectedDevice);
+    }
+    
+    // Fetched, decoded and turned into chart series by the worker
+    chartWorker.postMessage({
+        type: 'load',
+        generation: ++chartGeneration,
+        url: `/api/data/history?${params}`,
+        hours: selectedTimeRange,
+        device: selectedDevice,
+        chartFields: CHART_FIELDS
+    });
+    pendingChartRows = [];
+}
+
+// Build the charts from a worker 'loaded' message
+function renderCharts({ devices, charts: series }) {
+    if (devices.length === 0) {
+        console.log('No historical data available');
+        return;
+    }
+    
+    const datasets = (chartId) => devices.map((deviceId, index) => ({
+        deviceId,
+        color: chartColor(index),
+        points: toPoints(series[chartId][deviceId])
+    }));
+    
+    // Create/update charts
+    renderChart('temp-chart-dht22', 'DHT22 Temperature (°C)', datasets('temp-chart-dht22'));
+    renderChart('temp-chart-bmp280', 'BMP280 Temperature (°C)', datasets('temp-chart-bmp280'));
+    renderChart('humidity-chart', 'Humidity (%)', datasets('humidity-chart'));
+    renderChart('pressure-chart', 'Pressure (Pa)', datasets('pressure-chart'));
+    renderChart('altitude-chart', 'Altitude (m)', datasets('altitude-chart'));
+    renderHeapChart('heap-chart', datasets('heap-chart'));
+    renderChart('rssi-chart', 'RSSI (dBm)', datasets('rssi-chart'));
+    renderPressureTrendChart('pressure-trend-chart', datasets('pressure-trend-chart'));
+}
+
+// x/y arrays from the worker -> Chart.js points
+function toPoints({ x, y }) {
+    const points = new Array(x.length);
+    for (let i = 0; i < x.length; i++) {
+        points[i] = { x: x[i], y: y[i] };
     }
+    return points;
 }
 
-// Update charts data incrementally
+const CHART_COLORS = [
+    'rgb(255, 99, 132)',
+    'rgb(54, 162, 235)',
+    'rgb(255, 206, 86)',
+    'rgb(75, 192, 192)',
+    'rgb(153, 102, 255)',
+    'rgb(255, 159, 64)'
+];
+
+function chartColor(index) {
+    return CHART_COLORS[index % CHART_COLORS.length];
+}
+
+// Update charts data incrementally (polling fallback and stream catch-up)
 async function updateChartsData() {
-    try {
-        // Get latest data points
-        const params = new URLSearchParams({
-            hours: 1, // Just get last hour
-            limit: 100
-        });
-        
-        if (selectedDevice) {
-            params.append('device_id', selectedDevice);
-        }
-        
-        const response = await fetch(`/api/data/history?${params}`);
-        const data = await response.json();
-        
-        if (data.data.length === 0) return;
+    const params = new URLSearchParams({
+        hours: 1, // Just get last hour
+        limit: 100
+    });
+    
+    if (selectedDevice) {
+        params.append('device_id', selectedDevice);
+    }
+    
+    chartWorker.postMessage({
+        type: 'fetch-append',
+        generation: chartGeneration,
+        url: `/api/data/history?${params}`
+    });
+}
+
+// Queue live rows for the worker, one batch per animation frame
+function appendRowsToCharts(rows) {
+    if (rows.length === 0) return;
+    if (pendingChartRows.length === 0) {
+        requestAnimationFrame(flushChartRows);
+    }
+    pendingChartRows.push(...rows);
+}
+
+function flushChartRows() {
+    if (pendingChartRows.length === 0) return;
+    chartWorker.postMessage({ type: 'append', generation: chartGeneration, rows: pendingChartRows });
+    pendingChartRows = [];
+}
+
+// Append a worker 'patch' to the existing datasets. Chart.js only parses
+// the points pushed onto a dataset, so nothing else is recomputed.
+function applyChartPatch({ devices, charts: patch }) {
+    Object.entries(patch).forEach(([chartId, byDevice]) => {
+        const chart = charts[chartId];
+        if (!chart) return;
         
-        // Group by device
-        const deviceData = {};
-        data.data.forEach(row => {
-            if (!deviceData[row.device_id]) {
-                deviceData[row.device_id] = [];
+        Object.entries(byDevice).forEach(([deviceId, { drop, x, y }]) => {
+            let dataset = chart.data.datasets.find(ds => ds.label === deviceId);
+            if (!dataset) {
+                dataset = chartDataset(chartId, deviceId, chartColor(devices.indexOf(deviceId)), []);
+                chart.data.datasets.push(dataset);
+            }
+            dataset.data.push(...toPoints({ x, y }));
+            if (drop) {
+                // Points that left the time range
+                dataset.data.splice(0, drop);
             }
-            deviceData[row.device_id].push(row);
-        });
-        
-        // Update each chart
-        Object.keys(charts).forEach(chartId => {
-            const chart = charts[chartId];
-            if (!chart) return;
-            
-            // Skip special charts that have custom rendering logic
-            if (chartId === 'heap-chart' || chartId === 'pressure-trend-chart') return;
-            
-            const field = getFieldForChart(chartId);
-            if (!field) return; // Skip if no field mapping exists
-            
-            // Update each dataset
-            chart.data.datasets.forEach(dataset => {
-                const deviceId = dataset.label;
-                if (deviceData[deviceId]) {
-                    const newRows = deviceData[deviceId];
-                    
-                    // Get existing timestamps
-                    const existingTimestamps = new Set(dataset.data.map(d => d.x));
-                    
-                    // Collect all points (existing + new)
-                    const allPoints = [...dataset.data];
-                    
-                    // Add new data points (with absolute filtering only for now)
-                    newRows.forEach(row => {
-                        const timestamp = row.timestamp_server * 1000;
-                        const value = row[field];
-                        if (!existingTimestamps.has(timestamp) && isValidDataPoint(field, value)) {
-                            allPoints.push({
-                                x: timestamp,
-                                y: value
-                            });
-                        }
-                    });
-                    
-                    // Sort by timestamp
-                    allPoints.sort((a, b) => a.x - b.x);
-                    
-                    // Keep only data within time range
-                    const cutoffTime = Date.now() - (selectedTimeRange * 3600 * 1000);
-                    const recentPoints = allPoints.filter(d => d.x > cutoffTime);
-                    
-                    // Apply relative filtering to all points
-                    dataset.data = filterOutliersByMovingAverage(recentPoints, field);
-                }
-            });
-            
-            // Update chart without animation
-            chart.update('none');
         });
         
-    } catch (error) {
-        console.error('Error updating charts data:', error);
-    }
+        // Update chart without animation
+        chart.update('none');
+    });
 }
 
-// Helper function to get field name from chart ID
-function getFieldForChart(chartId) {
-    const fieldMap = {
-        'temp-chart-dht22': 'dht22_temperature_c',
-        'temp-chart-bmp280': 'bmp280_temperature_c',
-        'humidity-chart': 'dht22_humidity_percent',
-        'pressure-chart': 'bmp280_pressure_pa',
-        'altitude-chart': 'altitude_m',
-        'rssi-chart': 'rssi'
-    };
-    return fieldMap[chartId];
+// Measurement field plotted by each chart
+const CHART_FIELDS = {
+    'temp-chart-dht22': 'dht22_temperature_c',
+    'temp-chart-bmp280': 'bmp280_temperature_c',
+    'humidity-chart': 'dht22_humidity_percent',
+    'pressure-chart': 'bmp280_pressure_pa',
+    'altitude-chart': 'altitude_m',
+    'rssi-chart': 'rssi',
+    'heap-chart': 'free_heap',
+    // 3 hour tendency, computed and stored at ingest
+    'pressure-trend-chart': 'pressure_tendency_pa_3h'
+};
+
+// Points to request per series: roughly one per horizontal pixel
+function chartPointBudget() {
+    const canvas = document.getElementById('pressure-chart');
+    const width = canvas ? canvas.clientWidth * (window.devicePixelRatio || 1) : 0;
+    return Math.max(100, Math.min(2000, Math.round(width) || 800));
 }
 
-// Filter outliers based on field type (absolute limits)
-function isValidDataPoint(field, value) {
-    if (value === null || value === undefined) return false;
-    
-    // Define reasonable ranges for each sensor type
-    const ranges = {
-        'dht22_temperature_c': { min: -10, max: 50 },
-        'bmp280_temperature_c': { min: -10, max: 50 },
-        'dht22_humidity_percent': { min: 0, max: 100 },
-        'bmp280_pressure_pa': { min: 80000, max: 110000 },
-        'altitude_m': { min: -500, max: 5000 },
-        'free_heap': { min: 0, max: 400000 },
-        'rssi': { min: -100, max: 0 }
+// Dataset of one device on one chart, with the styling of that chart
+function chartDataset(chartId, deviceId, color, data) {
+    const dataset = {
+        label: deviceId,
+        data,
+        borderColor: color,
+        backgroundColor: color.replace('rgb', 'rgba').replace(')', ', 0.1)'),
+        tension: 0.4,
+        fill: true,
+        pointRadius: 2,
+        pointHoverRadius: 4,
+        // Points are already {x: ms, y} objects in time order
+        parsing: false,
+        spanGaps: true  // This interpolates across filtered points
     };
-    
-    const range = ranges[field];
-    if (!range) return true; // Unknown field, allow it
-    
-    return value >= range.min && value <= range.max;
+    if (chartId === 'pressure-trend-chart') {
+        dataset.segment = {
+            backgroundColor: (ctx) => {
+                // Color area green if rising (positive), red if falling (negative)
+                const y = ctx.p1.parsed.y;
+                return y >= 0 ? 'rgba(0, 255, 65, 0.2)' : 'rgba(255, 65, 0, 0.2)';
+            }
+        };
+    }
+    return dataset;
 }
 
-// Filter outliers using moving average (relative deviation)
-function filterOutliersByMovingAverage(dataPoints, field, windowSize = 5) {
-    if (dataPoints.length === 0) return dataPoints;
-    
-    // Define maximum allowed deviation from moving average
-    const deviationThresholds = {
-        'dht22_temperature_c': 5,      // ±5°C from moving average
-        'bmp280_temperature_c': 5,     // ±5°C from moving average
-        'dht22_humidity_percent': 15,   // ±15% from moving average
-        'bmp280_pressure_pa': 2000,    // ±2000 Pa from moving average
-        'altitude_m': 200,              // ±200m from moving average
-        'free_heap': 50000,             // ±50KB from moving average
-        'rssi': 20                      // ±20 dBm from moving average
-    };
-    
-    const maxDeviation = deviationThresholds[field];
-    if (!maxDeviation) return dataPoints; // No threshold defined, allow all
-    
-    const filtered = [];
-    
-    for (let i = 0; i < dataPoints.length; i++) {
-        const point = dataPoints[i];
-        
-        // First check absolute limits
-        if (!isValidDataPoint(field, point.y)) {
-            continue; // Skip this point
-        }
-        
-        // For first few points, accept them (not enough history for moving average)
-        if (i < windowSize) {
-            filtered.push(point);
-            continue;
-        }
-        
-        // Calculate moving average from previous valid points
-        const recentPoints = filtered.slice(-windowSize);
-        const sum = recentPoints.reduce((acc, p) => acc + p.y, 0);
-        const movingAvg = sum / recentPoints.length;
-        
-        // Check if current point deviates too much from moving average
-        const deviation = Math.abs(point.y - movingAvg);
-        
-        if (deviation <= maxDeviation) {
-            filtered.push(point);
-        }
-        // else: skip this point (it's an outlier)
+// Show a chart: new data and time unit for an existing one, which keeps
+// its canvas and state, or a new chart the first time
+function showChart(chartId, ctx, config) {
+    const chart = charts[chartId];
+    if (!chart) {
+        charts[chartId] = new Chart(ctx, config);
+        return;
     }
-    
-    return filtered;
+    chart.data.datasets = config.data.datasets;
+    chart.options.scales.x.time.unit = config.options.scales.x.time.unit;
+    chart.update('none');
 }
 
 // Render or update a chart
-function renderChart(chartId, title, datasets, field) {
+function renderChart(chartId, title, datasets) {
     const ctx = document.getElementById(chartId);
     if (!ctx) {
         console.error(`Canvas not found: ${chartId}`);
         return;
     }
     
-    console.log(`Rendering ${chartId} for field ${field}, datasets: ${datasets.length}`);
+    console.log(`Rendering ${chartId} (${title}), datasets: ${datasets.length}`);
     
-    const chartDatasets = datasets.map(ds => {
-        // First map all points
-        const allPoints = ds.rows.map(row => ({
-            x: row.timestamp_server * 1000,
-            y: row[field]
-        }));
-        
-        console.log(`  ${ds.deviceId}: ${allPoints.length} points, field values:`, allPoints.slice(0, 3).map(p => p.y));
-        
-        // Apply both absolute and relative filtering
-        const filteredPoints = filterOutliersByMovingAverage(allPoints, field);
-        
-        console.log(`  ${ds.deviceId}: ${filteredPoints.length} after filtering`);
-        
-        return {
-            label: ds.deviceId,
-            data: filteredPoints,
-            borderColor: ds.color,
-            backgroundColor: ds.color.replace('rgb', 'rgba').replace(')', ', 0.1)'),
-            tension: 0.4,
-            fill: true,
-            pointRadius: 2,
-            pointHoverRadius: 4,
-            spanGaps: true  // This interpolates across filtered points
-        };
-    });
+    // Already outlier-filtered and downsampled by the server
+    const chartDatasets = datasets.map(ds => chartDataset(chartId, ds.deviceId, ds.color, ds.points));
     
     const config = {
         type: 'line',
@@ -680,6 +696,7 @@ function renderChart(chartId, title, datasets, field) {
         options: {
             responsive: true,
             maintainAspectRatio: true,
+            normalized: true,
             interaction: {
                 mode: 'index',
                 intersect: false,
@@ -772,81 +789,15 @@ function renderChart(chartId, title, datasets, field) {
         }
     };
     
-    // Destroy existing chart if it exists
-    if (charts[chartId]) {
-        charts[chartId].destroy();
-    }
-    
-    // Create new chart
-    charts[chartId] = new Chart(ctx, config);
+    showChart(chartId, ctx, config);
 }
 
-// Render pressure trend chart (calculates rate of change)
+// Render pressure trend chart (3 hour tendency, stored at ingest)
 function renderPressureTrendChart(chartId, datasets) {
     const ctx = document.getElementById(chartId);
     if (!ctx) return;
     
-    // Calculate pressure trends for each device
-    const chartDatasets = datasets.map(({deviceId, color, rows}) => {
-        const trendData = [];
-        
-        // Calculate trend using variable time windows (prefer 1 hour, accept 15min-2hour)
-        for (let i = 0; i < rows.length; i++) {
-            const currentRow = rows[i];
-            const currentTime = currentRow.timestamp_server;
-            const currentPressure = currentRow.bmp280_pressure_pa;
-            
-            if (!isValidDataPoint('bmp280_pressure_pa', currentPressure)) continue;
-            
-            // Find best historical data point (prefer ~1 hour, accept 15min - 2 hours)
-            let pastRow = null;
-            let bestTimeDiff = Infinity;
-            
-            for (let j = i - 1; j >= 0; j--) {
-                const timeDiff = currentTime - rows[j].timestamp_server;
-                
-                // Only consider data between 15 minutes and 2 hours ago
-                if (timeDiff >= 900 && timeDiff <= 7200) {
-                    // Prefer data closest to 1 hour (3600 seconds)
-                    const diffFrom1Hour = Math.abs(timeDiff - 3600);
-                    if (diffFrom1Hour < bestTimeDiff) {
-                        bestTimeDiff = diffFrom1Hour;
-                        pastRow = rows[j];
-                    }
-                }
-            }
-            
-            if (pastRow && isValidDataPoint('bmp280_pressure_pa', pastRow.bmp280_pressure_pa)) {
-                const timeDiffHours = (currentTime - pastRow.timestamp_server) / 3600;
-                const pressureDiff = currentPressure - pastRow.bmp280_pressure_pa;
-                const trend = pressureDiff / timeDiffHours; // Pa/hour
-                
-                trendData.push({
-                    x: currentTime * 1000,
-                    y: trend
-                });
-            }
-        }
-        
-        return {
-            label: deviceId,
-            data: trendData,
-            borderColor: color,
-            backgroundColor: color.replace('rgb', 'rgba').replace(')', ', 0.1)'),
-            tension: 0.4,
-            fill: true,
-            pointRadius: 2,
-            pointHoverRadius: 4,
-            segment: {
-                backgroundColor: (ctx) => {
-                    // Color area green if rising (positive), red if falling (negative)
-                    const y = ctx.p1.parsed.y;
-                    return y >= 0 ? 'rgba(0, 255, 65, 0.2)' : 'rgba(255, 65, 0, 0.2)';
-                }
-            },
-            spanGaps: true
-        };
-    });
+    const chartDatasets = datasets.map(ds => chartDataset(chartId, ds.deviceId, ds.color, ds.points));
     
     const config = {
         type: 'line',
@@ -854,6 +805,7 @@ function renderPressureTrendChart(chartId, datasets) {
         options: {
             responsive: true,
             maintainAspectRatio: true,
+            normalized: true,
             interaction: {
                 mode: 'index',
                 intersect: false,
@@ -893,7 +845,7 @@ function renderPressureTrendChart(chartId, datasets) {
                         label: (context) => {
                             const trend = context.parsed.y;
                             const direction = trend > 0 ? '↑ Rising' : trend < 0 ? '↓ Falling' : '→ Stable';
-                            return `${context.dataset.label}: ${trend.toFixed(1)} Pa/h ${direction}`;
+                            return `${context.dataset.label}: ${trend.toFixed(1)} Pa/3h ${direction}`;
                         }
                     }
                 }
@@ -927,7 +879,7 @@ function renderPressureTrendChart(chartId, datasets) {
                         color: '#8892b0',
                         font: { family: 'Courier New, monospace', size: 10 },
                         callback: function(value) {
-                            return value.toFixed(1) + ' Pa/h';
+                            return value.toFixed(1) + ' Pa/3h';
                         }
                     },
                     grid: { color: '#1e2a4a' }
@@ -936,40 +888,18 @@ function renderPressureTrendChart(chartId, datasets) {
         }
     };
     
-    if (charts[chartId]) {
-        charts[chartId].destroy();
-    }
-    charts[chartId] = new Chart(ctx, config);
+    showChart(chartId, ctx, config);
 }
 
-// Render heap memory chart as percentage
+// Render heap memory chart as percentage (converted by the worker)
 function renderHeapChart(chartId, datasets) {
     const ctx = document.getElementById(chartId);
     if (!ctx) return;
     
-    // Convert heap bytes to percentage (ESP32 WROOM-32 total heap ~320KB = 327680 bytes)
+    // ESP32 WROOM-32 total heap ~320KB = 327680 bytes, for the tooltip
     const ESP32_TOTAL_HEAP = 327680;
     
-    const chartDatasets = datasets.map(({deviceId, color, rows}) => {
-        const heapData = rows
-            .filter(row => isValidDataPoint('free_heap', row.free_heap))
-            .map(row => ({
-                x: row.timestamp_server * 1000,
-                y: ((ESP32_TOTAL_HEAP - row.free_heap) / ESP32_TOTAL_HEAP) * 100  // Used heap percentage
-            }));
-        
-        return {
-            label: deviceId,
-            data: heapData,
-            borderColor: color,
-            backgroundColor: color.replace('rgb', 'rgba').replace(')', ', 0.1)'),
-            tension: 0.4,
-            fill: true,
-            pointRadius: 2,
-            pointHoverRadius: 4,
-            spanGaps: true
-        };
-    });
+    const chartDatasets = datasets.map(ds => chartDataset(chartId, ds.deviceId, ds.color, ds.points));
     
     const config = {
         type: 'line',
@@ -977,6 +907,7 @@ function renderHeapChart(chartId, datasets) {
         options: {
             responsive: true,
             maintainAspectRatio: false,
+            normalized: true,
             interaction: {
                 mode: 'index',
                 intersect: false,
@@ -1061,10 +992,7 @@ function renderHeapChart(chartId, datasets) {
         }
     };
     
-    if (charts[chartId]) {
-        charts[chartId].destroy();
-    }
-    charts[chartId] = new Chart(ctx, config);
+    showChart(chartId, ctx, config);
 }
 
 // Load statistics (full render)
@@ -1074,6 +1002,7 @@ async function loadStatistics() {
         const data = await response.json();
         
         const statsGrid = document.getElementById('stats-grid');
+        statsCache = data.overall;
         
         // Check if cards already exist
         const existingCards = statsGrid.querySelectorAll('.stat-card');
@@ -1112,6 +1041,16 @@ async function loadStatistics() {
     }
 }
 
+// Count a pushed measurement into the statistics cards
+function bumpStatistics(row) {
+    if (!statsCache) return;
+    
+    statsCache.total_measurements += 1;
+    statsCache.last_measurement = row.timestamp_server;
+    updateStatValue('total-measurements', statsCache.total_measurements.toLocaleString());
+    updateStatValue('last-measurement', formatTimestamp(statsCache.last_measurement));
+}
+
 // Update individual stat card value
 function updateStatValue(statName, value) {
     const card = document.querySelector(`[data-stat="${statName}"] .stat-value`);
@@ -1160,6 +1099,8 @@ async function runQuery() {
         return;
     }
     
+    const resultsDiv = document.getElementById('query-results');
+    
     try {
         const response = await fetch('/api/query', {
             method: 'POST',
@@ -1169,40 +1110,131 @@ async function runQuery() {
             body: JSON.stringify({ query })
         });
         
-        const data = await response.json();
-        const resultsDiv = document.getElementById('query-results');
-        
         if (!response.ok) {
+            const data = await response.json();
             resultsDiv.innerHTML = `<div class="query-error">Error: ${data.detail || 'Query failed'}</div>`;
             return;
         }
         
-        if (!data.results || data.results.length === 0) {
-            resultsDiv.innerHTML = '<p class="empty-state">No results returned</p>';
-            return;
-        }
+        // NDJSON: header line, one array per row, closing summary line
+        const reader = response.body.getReader();
+        const decoder = new TextDecoder();
+        let buffered = '';
+        let tbody = null;
+        let summary = null;
         
-        // Build table
-        const columns = Object.keys(data.results[0]);
-        let html = '<table><thead><tr>';
-        columns.forEach(col => {
-            html += `<th>${col}</th>`;
-        });
-        html += '</tr></thead><tbody>';
+        const handleLine = (line) => {
+            if (!line) return '';
+            const item = JSON.parse(line);
+            
+            if (Array.isArray(item)) {
+                return '<tr>' + item.map(v => `<td>${v !== null ? v : 'NULL'}</td>`).join('') + '</tr>';
+            }
+            
+            if (item.columns) {
+                resultsDiv.innerHTML = renderQueryPlan(item.plan) +
+                    '<table><thead><tr>' + item.columns.map(col => `<th>${col}</th>`).join('') +
+                    '</tr></thead><tbody></tbody></table>';
+                tbody = resultsDiv.querySelector('tbody');
+            } else if (item.done) {
+                summary = item;
+            }
+            return '';
+        };
         
-        data.results.forEach(row => {
-            html += '<tr>';
-            columns.forEach(col => {
-                html += `<td>${row[col] !== null ? row[col] : 'NULL'}</td>`;
-            });
-            html += '</tr>';
-        });
-        html += '</tbody></table>';
+        while (true) {
+            const { value, done } = await reader.read();
+            if (done) break;
+            
+            buffered += decoder.decode(value, { stream: true });
+            const lines = buffered.split('\n');
+            buffered = lines.pop();
+            
+            // Append each network chunk's rows in one DOM update
+            const html = lines.map(handleLine).join('');
+            if (html && tbody) {
+                tbody.insertAdjacentHTML('beforeend', html);
+            }
+        }
+        handleLine(buffered);
         
-        resultsDiv.innerHTML = html;
+        if (summary) {
+            resultsDiv.insertAdjacentHTML('beforeend', renderQuerySummary(summary));
+        }
     } catch (error) {
         console.error('Error running query:', error);
-        document.getElementById('query-results').innerHTML = 
-            `<div class="query-error">Error: ${error.message}</div>`;
+        resultsDiv.innerHTML = `<div class="query-error">Error: ${error.message}</div>`;
+    }
+}
+
+// Query plan notice shown above the results
+function renderQueryPlan(plan) {
+    if (!plan) return '';
+    const steps = plan.steps.join(' → ');
+    if (plan.full_scans.length > 0) {
+        return `<div class="query-plan warning">⚠ Full scan: ${plan.full_scans.join(', ')}<br><small>${steps}</small></div>`;
+    }
+    return `<div class="query-plan"><small>Plan: ${steps}</small></div>`;
+}
+
+// Row count, timing and limit notice shown below the results
+function renderQuerySummary(summary) {
+    const reasons = {
+        row_limit: 'row limit reached',
+        size_limit: 'response size limit reached',
+        timeout: 'time limit reached',
+        error: summary.error
+    };
+    const text = `${summary.count.toLocaleString()} rows in ${summary.elapsed_ms} ms`;
+    if (summary.truncated) {
+        return `<div class="query-plan warning">${text} (truncated: ${reasons[summary.reason] || summary.reason})</div>`;
     }
+    return `<div class="query-plan"><small>${text}</small></div>`;
+}
+
+// Frame timing (?perf=1): intervals between animation frames, long tasks
+// (main thread busy > 50 ms, Chromium only) and time spent applying chart
+// data. Logged every 10 s; dashboardPerf.report() / .reset() in the console.
+function startPerfMonitor() {
+    let last = performance.now();
+    const tick = (now) => {
+        perfStats.frames.push(now - last);
+        last = now;
+        requestAnimationFrame(tick);
+    };
+    requestAnimationFrame(tick);
+    
+    if ((PerformanceObserver.supportedEntryTypes || []).includes('longtask')) {
+        new PerformanceObserver((list) => {
+            list.getEntries().forEach(entry => perfStats.longTasks.push(entry.duration));
+        }).observe({ type: 'longtask' });
+    }
+    
+    window.dashboardPerf = { report: perfReport, reset: perfReset };
+    setInterval(() => console.log('[perf]', perfReport()), 10000);
+}
+
+function perfReport() {
+    const percentile = (values, p) => {
+        if (values.length === 0) return 0;
+        const sorted = [...values].sort((a, b) => a - b);
+        return Math.round(sorted[Math.floor(p * (sorted.length - 1))] * 10) / 10;
+    };
+    const { frames, longTasks, chartWork } = perfStats;
+    return {
+        frames: frames.length,
+        frameP50: percentile(frames, 0.5),
+        frameP95: percentile(frames, 0.95),
+        frameMax: percentile(frames, 1),
+        longTasks: longTasks.length,
+        blockingMs: Math.round(longTasks.reduce((sum, d) => sum + Math.max(0, d - 50), 0)),
+        chartWorkP95: percentile(chartWork, 0.95),
+        chartWorkMax: percentile(chartWork, 1)
+    };
+}
+
+function perfReset() {
+    perfStats.frames = [];
+    perfStats.longTasks = [];
+    perfStats.chartWork = [];
 }
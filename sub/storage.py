@@ -0,0 +1,711 @@
+import json
+import math
+import sqlite3
+import time
+from typing import Any, Dict, List, Tuple
+
+from derived import DERIVED_FIELDS
+from quality import field_flagged, good_value_sql
+
+# ----------------------------
+# Schema
+# ----------------------------
+
+# Columns of the measurements table in storage order, excluding the id.
+MEASUREMENT_COLUMNS = (
+    "device_id",
+    "topic",
+    "dht22_temperature_c",
+    "dht22_humidity_percent",
+    "bmp280_temperature_c",
+    "bmp280_pressure_pa",
+    "timestamp_device",
+    "timestamp_server",
+    "firmware_version",
+    "rssi",
+    "altitude_m",
+    "free_heap",
+    "quality",
+    *DERIVED_FIELDS,
+)
+
+# Columns added after the first deployments; older databases get them on
+# startup through ALTER TABLE.
+ADDED_COLUMNS = {
+    "altitude_m": "REAL",
+    "free_heap": "INTEGER",
+    "quality": "INTEGER NOT NULL DEFAULT 0",
+    **{field: "REAL" for field in DERIVED_FIELDS},
+}
+
+# Length of the tumbling window used for the per-device "messages in the
+# last 5 minutes" counter.
+DEVICE_WINDOW_SECONDS = 300
+
+# Smoothing factor of the exponentially weighted RSSI average.
+RSSI_EWMA_ALPHA = 0.2
+
+# Fields with running count/mean/variance/min/max in device_stats.
+STAT_FIELDS = (
+    "dht22_temperature_c",
+    "dht22_humidity_percent",
+    "bmp280_temperature_c",
+    "bmp280_pressure_pa",
+    "rssi",
+)
+
+
+def measurements_table_sql(name: str) -> str:
+    """
+    Clustered measurements layout: rows are stored in primary key order, so a
+    device's readings over a time range sit next to each other on disk and
+    are read without a second lookup per row. id stays unique and increasing
+    across devices and breaks ties between readings in the same second.
+    """
+    return f"""
+        CREATE TABLE IF NOT EXISTS {name} (
+            id INTEGER NOT NULL,
+
+            device_id TEXT NOT NULL,
+            topic TEXT NOT NULL,
+
+            dht22_temperature_c REAL,
+            dht22_humidity_percent REAL,
+
+            bmp280_temperature_c REAL,
+            bmp280_pressure_pa REAL,
+
+            timestamp_device INTEGER,
+            timestamp_server INTEGER NOT NULL,
+
+            firmware_version TEXT,
+            rssi INTEGER,
+            altitude_m REAL,
+            free_heap INTEGER,
+            quality INTEGER NOT NULL DEFAULT 0,
+
+            dew_point_c REAL,
+            absolute_humidity_gm3 REAL,
+            pressure_qnh_pa REAL,
+            pressure_tendency_pa_3h REAL,
+
+            PRIMARY KEY (device_id, timestamp_server, id)
+        ) WITHOUT ROWID
+    """
+
+
+def measurements_index_sql(name: str) -> Tuple[str, ...]:
+    # Cross-device reads by time: latest rows, history and export without a
+    # device filter. Per-device reads use the primary key. Flagged rows are a
+    # small minority, so listing them gets its own partial index.
+    return (
+        f"CREATE INDEX IF NOT EXISTS idx_measurements_time ON {name}(timestamp_server, id)",
+        f"""CREATE INDEX IF NOT EXISTS idx_measurements_flagged
+            ON {name}(timestamp_server, id) WHERE quality != 0""",
+    )
+
+
+def is_clustered(conn: sqlite3.Connection) -> bool:
+    row = conn.execute(
+        "SELECT sql FROM sqlite_master WHERE type = 'table' AND name = 'measurements'"
+    ).fetchone()
+    return row is not None and "WITHOUT ROWID" in row[0].upper()
+
+
+def init_db(conn: sqlite3.Connection) -> None:
+    # WAL lets the web server's read-only connections run concurrently with
+    # ingest instead of waiting on the writer's lock.
+    conn.execute("PRAGMA journal_mode=WAL")
+
+    cursor = conn.cursor()
+    cursor.execute(measurements_table_sql("measurements"))
+
+    existing = {row[1] for row in cursor.execute("PRAGMA table_info(measurements)")}
+    for column, column_type in ADDED_COLUMNS.items():
+        if column not in existing:
+            cursor.execute(f"ALTER TABLE measurements ADD COLUMN {column} {column_type}")
+
+    if is_clustered(conn):
+        for index_sql in measurements_index_sql("measurements"):
+            cursor.execute(index_sql)
+    else:
+        # Databases created before the clustered layout keep their rowid table
+        # and its indexes until migrate_clustered.py converts them.
+        cursor.execute("""
+            CREATE INDEX IF NOT EXISTS idx_device_time
+            ON measurements(device_id, timestamp_server)
+        """)
+
+        cursor.execute("""
+            CREATE INDEX IF NOT EXISTS idx_time
+            ON measurements(timestamp_server)
+        """)
+
+        cursor.execute("""
+            CREATE INDEX IF NOT EXISTS idx_flagged
+            ON measurements(timestamp_server) WHERE quality != 0
+        """)
+
+    # Measurement ids are handed out from here rather than by AUTOINCREMENT,
+    # which only exists for rowid tables. Seeded once from the existing rows.
+    cursor.execute("""
+        CREATE TABLE IF NOT EXISTS id_sequence (
+            name TEXT PRIMARY KEY,
+            value INTEGER NOT NULL
+        ) WITHOUT ROWID
+    """)
+    if not cursor.execute("SELECT 1 FROM id_sequence WHERE name = 'measurements'").fetchone():
+        cursor.execute("""
+            INSERT INTO id_sequence (name, value)
+            SELECT 'measurements', COALESCE(MAX(id), 0) FROM measurements
+        """)
+
+    # One row per device, maintained on every insert so status and latest
+    # reading lookups never touch the measurements table.
+    cursor.execute("""
+        CREATE TABLE IF NOT EXISTS device_state (
+            device_id TEXT PRIMARY KEY,
+
+            last_id INTEGER NOT NULL,
+            first_seen INTEGER NOT NULL,
+            last_seen INTEGER NOT NULL,
+
+            firmware_version TEXT,
+            rssi INTEGER,
+            rssi_avg REAL,
+
+            message_count INTEGER NOT NULL,
+            window_start INTEGER NOT NULL,
+            window_count INTEGER NOT NULL,
+            prev_window_count INTEGER NOT NULL,
+
+            last_reading TEXT NOT NULL
+        ) WITHOUT ROWID
+    """)
+
+    # Running aggregates per device, updated with Welford's method on every
+    # insert so /api/stats and /api/health never scan measurements.
+    field_columns = ",\n".join(
+        f"""
+            {f}_n INTEGER NOT NULL DEFAULT 0,
+            {f}_mean REAL NOT NULL DEFAULT 0.0,
+            {f}_m2 REAL NOT NULL DEFAULT 0.0,
+            {f}_min REAL,
+            {f}_max REAL"""
+        for f in STAT_FIELDS
+    )
+    cursor.execute(f"""
+        CREATE TABLE IF NOT EXISTS device_stats (
+            device_id TEXT PRIMARY KEY,
+
+            message_count INTEGER NOT NULL,
+            first_seen INTEGER NOT NULL,
+            last_seen INTEGER NOT NULL,
+            {field_columns}
+        ) WITHOUT ROWID
+    """)
+
+    conn.commit()
+
+    has_data = cursor.execute("SELECT 1 FROM measurements LIMIT 1").fetchone()
+    if has_data:
+        if not cursor.execute("SELECT 1 FROM device_state LIMIT 1").fetchone():
+            rebuild_device_state(conn)
+        if not cursor.execute("SELECT 1 FROM device_stats LIMIT 1").fetchone():
+            rebuild_device_stats(conn)
+
+
+# ----------------------------
+# Payload parsing
+# ----------------------------
+
+
+def safe_get(d: Dict[str, Any], *keys):
+    cur = d
+    for k in keys:
+        if not isinstance(cur, dict):
+            return None
+        cur = cur.get(k)
+    return cur
+
+
+# Range of SQLite's 64-bit integers; Python ints outside it cannot be bound.
+SQLITE_INT_MIN = -(2**63)
+SQLITE_INT_MAX = 2**63 - 1
+
+
+# Payload fields that must be numbers: the stats, checks and derived fields
+# do arithmetic on them.
+NUMERIC_FIELDS = (
+    "dht22_temperature_c",
+    "dht22_humidity_percent",
+    "bmp280_temperature_c",
+    "bmp280_pressure_pa",
+    "rssi",
+    "altitude_m",
+    "free_heap",
+)
+
+
+class InvalidPayload(ValueError):
+    pass
+
+
+def is_sqlite_scalar(value: Any) -> bool:
+    """True for values SQLite can store as given: NULL, text, real or a 64-bit integer."""
+    if value is None or isinstance(value, (str, float)):
+        return True
+    return isinstance(value, int) and SQLITE_INT_MIN <= value <= SQLITE_INT_MAX
+
+
+def is_finite_number(value: Any) -> bool:
+    """True for a finite float or a 64-bit integer; bools and strings such as "inf" are not numbers."""
+    if isinstance(value, bool):
+        return False
+    if isinstance(value, float):
+        return math.isfinite(value)
+    return isinstance(value, int) and SQLITE_INT_MIN <= value <= SQLITE_INT_MAX
+
+
+def measurement_from_payload(topic: str, payload: Dict[str, Any], now: int) -> Dict[str, Any]:
+    """
+    Map a decoded mqtt_pub.c payload to a measurements row (without id).
+    Raises InvalidPayload if a field is not a value SQLite can store, e.g.
+    an object or an integer beyond 64 bits, or if a numeric field holds
+    anything but a finite number or null (a string, true, NaN, Infinity).
+    """
+    ts_device = payload.get("ts_device")
+    measurement = {
+        "device_id": payload.get("device_id", "unknown"),
+        "topic": topic,
+        "dht22_temperature_c": safe_get(payload, "dht22", "temperature_c"),
+        "dht22_humidity_percent": safe_get(payload, "dht22", "humidity_percent"),
+        "bmp280_temperature_c": safe_get(payload, "bmp280", "temperature_c"),
+        "bmp280_pressure_pa": safe_get(payload, "bmp280", "pressure_pa"),
+        # Orders a device's rows, so anything but an integer is dropped.
+        "timestamp_device": ts_device if isinstance(ts_device, int) and not isinstance(ts_device, bool) else None,
+        "timestamp_server": now,
+        "firmware_version": payload.get("fw"),
+        "rssi": payload.get("rssi"),
+        "altitude_m": payload.get("altitude_m"),
+        "free_heap": payload.get("free_heap"),
+        # Set by the ingest process's QualityDetector and DerivedFields.
+        "quality": 0,
+        **dict.fromkeys(DERIVED_FIELDS),
+    }
+    if not isinstance(measurement["device_id"], str) or not isinstance(topic, str):
+        raise InvalidPayload("device_id is not a string")
+    for field, value in measurement.items():
+        if not is_sqlite_scalar(value):
+            raise InvalidPayload(f"{field} is not a number or string")
+    for field in NUMERIC_FIELDS:
+        value = measurement[field]
+        if value is not None and not is_finite_number(value):
+            raise InvalidPayload(f"{field} is not a finite number: {value!r}")
+    return measurement
+
+
+# ----------------------------
+# Writes
+# ----------------------------
+
+INSERT_MEASUREMENT_SQL = f"""
+    INSERT INTO measurements (id, {", ".join(MEASUREMENT_COLUMNS)})
+    VALUES (?, {", ".join("?" for _ in MEASUREMENT_COLUMNS)})
+"""
+
+
+def reserve_ids(conn: sqlite3.Connection, count: int = 1) -> int:
+    """
+    Take `count` consecutive measurement ids and return the first. Runs in
+    the caller's transaction, so a rollback gives the ids back.
+    """
+    (last,) = conn.execute(
+        "UPDATE id_sequence SET value = value + ? WHERE name = 'measurements' RETURNING value",
+        (count,),
+    ).fetchone()
+    return last - count + 1
+
+
+# All right-hand sides of an UPDATE see the row as it was before the update,
+# so the window roll-over can be expressed against the stored window_start.
+UPSERT_DEVICE_STATE_SQL = f"""
+    INSERT INTO device_state (
+        device_id, last_id, first_seen, last_seen,
+        firmware_version, rssi, rssi_avg,
+        message_count, window_start, window_count, prev_window_count,
+        last_reading
+    ) VALUES (
+        :device_id, :last_id, :seen, :seen,
+        :firmware_version, :rssi, :rssi,
+        1, :window_start, 1, 0,
+        :last_reading
+    )
+    ON CONFLICT(device_id) DO UPDATE SET
+        last_id = excluded.last_id,
+        last_seen = excluded.last_seen,
+        firmware_version = COALESCE(excluded.firmware_version, firmware_version),
+        rssi = excluded.rssi,
+        rssi_avg = CASE
+            WHEN excluded.rssi IS NULL THEN rssi_avg
+            WHEN rssi_avg IS NULL THEN excluded.rssi
+            ELSE rssi_avg + {RSSI_EWMA_ALPHA} * (excluded.rssi - rssi_avg)
+        END,
+        message_count = message_count + 1,
+        prev_window_count = CASE
+            WHEN excluded.window_start = window_start THEN prev_window_count
+            WHEN excluded.window_start = window_start + {DEVICE_WINDOW_SECONDS} THEN window_count
+            ELSE 0
+        END,
+        window_count = CASE
+            WHEN excluded.window_start = window_start THEN window_count + 1
+            ELSE 1
+        END,
+        window_start = excluded.window_start,
+        last_reading = excluded.last_reading
+    RETURNING
+        device_id, first_seen, last_seen, firmware_version, rssi, rssi_avg,
+        message_count, window_start, window_count, prev_window_count
+"""
+
+
+def insert_measurement(
+    conn: sqlite3.Connection, measurement: Dict[str, Any]
+) -> Tuple[Dict[str, Any], Dict[str, Any]]:
+    """
+    Insert one measurement and update its device_state row. Does not commit,
+    the caller owns the transaction so both writes land together.
+
+    Returns the stored row (with its id) and the updated device state.
+    """
+    measurement_id = reserve_ids(conn)
+    conn.execute(
+        INSERT_MEASUREMENT_SQL, [measurement_id, *(measurement[c] for c in MEASUREMENT_COLUMNS)]
+    )
+    reading = {"id": measurement_id, **measurement}
+    state = update_device_state(conn, reading)
+    update_device_stats(conn, reading)
+    return reading, state
+
+
+def update_device_state(conn: sqlite3.Connection, reading: Dict[str, Any]) -> Dict[str, Any]:
+    seen = reading["timestamp_server"]
+    cursor = conn.execute(
+        UPSERT_DEVICE_STATE_SQL,
+        {
+            "device_id": reading["device_id"],
+            "last_id": reading["id"],
+            "seen": seen,
+            "firmware_version": reading["firmware_version"],
+            "rssi": reading["rssi"],
+            "window_start": seen - seen % DEVICE_WINDOW_SECONDS,
+            "last_reading": json.dumps(reading, separators=(",", ":")),
+        },
+    )
+    columns = [d[0] for d in cursor.description]
+    return dict(zip(columns, cursor.fetchone()))
+
+
+def _welford_update_sql(field: str) -> str:
+    # Bound parameter :f is the new value. Every right-hand side sees the old
+    # row, so the updated mean is spelled out again inside the m2 update.
+    v, n, mean, m2 = f":{field}", f"{field}_n", f"{field}_mean", f"{field}_m2"
+    new_mean = f"({mean} + ({v} - {mean}) / ({n} + 1))"
+    return f"""
+        {n} = {n} + ({v} IS NOT NULL),
+        {mean} = CASE WHEN {v} IS NULL THEN {mean} ELSE {new_mean} END,
+        {m2} = CASE WHEN {v} IS NULL THEN {m2} ELSE {m2} + ({v} - {mean}) * ({v} - {new_mean}) END,
+        {field}_min = CASE WHEN {v} IS NULL THEN {field}_min ELSE MIN(COALESCE({field}_min, {v}), {v}) END,
+        {field}_max = CASE WHEN {v} IS NULL THEN {field}_max ELSE MAX(COALESCE({field}_max, {v}), {v}) END"""
+
+
+UPSERT_DEVICE_STATS_SQL = f"""
+    INSERT INTO device_stats (
+        device_id, message_count, first_seen, last_seen,
+        {", ".join(f"{f}_n, {f}_mean, {f}_min, {f}_max" for f in STAT_FIELDS)}
+    ) VALUES (
+        :device_id, 1, :seen, :seen,
+        {", ".join(f"(:{f} IS NOT NULL), COALESCE(:{f}, 0.0), :{f}, :{f}" for f in STAT_FIELDS)}
+    )
+    ON CONFLICT(device_id) DO UPDATE SET
+        message_count = message_count + 1,
+        first_seen = MIN(first_seen, excluded.first_seen),
+        last_seen = MAX(last_seen, excluded.last_seen),
+        {",".join(_welford_update_sql(f) for f in STAT_FIELDS)}
+"""
+
+
+def update_device_stats(conn: sqlite3.Connection, reading: Dict[str, Any]) -> None:
+    # Flagged values, such as -999 from a failed read, stay out of the stats.
+    quality = reading["quality"]
+    params = {
+        f: (float(reading[f]) if reading[f] is not None and not field_flagged(quality, f) else None)
+        for f in STAT_FIELDS
+    }
+    params["device_id"] = reading["device_id"]
+    params["seen"] = reading["timestamp_server"]
+    conn.execute(UPSERT_DEVICE_STATS_SQL, params)
+
+
+# Rows stored out of band (import_archive.py) are folded into the aggregates
+# per device and batch rather than per row. device_state only moves forward:
+# the latest-reading columns change only for rows newer than last_seen, and
+# the 5 minute counters are left to messages main.py receives.
+MERGE_DEVICE_STATE_SQL = """
+    INSERT INTO device_state (
+        device_id, last_id, first_seen, last_seen,
+        firmware_version, rssi, rssi_avg,
+        message_count, window_start, window_count, prev_window_count,
+        last_reading
+    ) VALUES (
+        :device_id, :last_id, :first_seen, :last_seen,
+        :firmware_version, :rssi, :rssi,
+        :message_count, :window_start, 0, 0,
+        :last_reading
+    )
+    ON CONFLICT(device_id) DO UPDATE SET
+        first_seen = MIN(first_seen, excluded.first_seen),
+        message_count = message_count + excluded.message_count,
+        last_id = CASE WHEN excluded.last_seen > last_seen THEN excluded.last_id ELSE last_id END,
+        firmware_version = CASE
+            WHEN excluded.last_seen > last_seen THEN COALESCE(excluded.firmware_version, firmware_version)
+            ELSE firmware_version
+        END,
+        rssi = CASE WHEN excluded.last_seen > last_seen THEN excluded.rssi ELSE rssi END,
+        last_reading = CASE WHEN excluded.last_seen > last_seen THEN excluded.last_reading ELSE last_reading END,
+        last_seen = MAX(last_seen, excluded.last_seen)
+"""
+
+
+def _merge_stats_sql(field: str) -> str:
+    # Chan et al.'s pairwise update: combines the stored (n, mean, m2) with
+    # the batch's, as if the batch's values had been added one by one.
+    n, mean, m2 = f"{field}_n", f"{field}_mean", f"{field}_m2"
+    bn, bmean, bm2 = f"excluded.{n}", f"excluded.{mean}", f"excluded.{m2}"
+    return f"""
+        {n} = {n} + {bn},
+        {mean} = CASE WHEN {bn} = 0 THEN {mean} ELSE {mean} + ({bmean} - {mean}) * {bn} / ({n} + {bn}) END,
+        {m2} = CASE WHEN {bn} = 0 THEN {m2}
+            ELSE {m2} + {bm2} + ({bmean} - {mean}) * ({bmean} - {mean}) * {n} * {bn} / ({n} + {bn}) END,
+        {field}_min = CASE WHEN {bn} = 0 THEN {field}_min ELSE MIN(COALESCE({field}_min, excluded.{field}_min), excluded.{field}_min) END,
+        {field}_max = CASE WHEN {bn} = 0 THEN {field}_max ELSE MAX(COALESCE({field}_max, excluded.{field}_max), excluded.{field}_max) END"""
+
+
+MERGE_DEVICE_STATS_SQL = f"""
+    INSERT INTO device_stats (
+        device_id, message_count, first_seen, last_seen,
+        {", ".join(f"{f}_n, {f}_mean, {f}_m2, {f}_min, {f}_max" for f in STAT_FIELDS)}
+    ) VALUES (
+        :device_id, :message_count, :first_seen, :last_seen,
+        {", ".join(f":{f}_n, :{f}_mean, :{f}_m2, :{f}_min, :{f}_max" for f in STAT_FIELDS)}
+    )
+    ON CONFLICT(device_id) DO UPDATE SET
+        message_count = message_count + excluded.message_count,
+        first_seen = MIN(first_seen, excluded.first_seen),
+        last_seen = MAX(last_seen, excluded.last_seen),
+        {",".join(_merge_stats_sql(f) for f in STAT_FIELDS)}
+"""
+
+
+def merge_device_aggregates(conn: sqlite3.Connection, readings: List[Dict[str, Any]]) -> None:
+    """
+    Add stored readings (with their ids) to device_state and device_stats,
+    one statement each per device. Does not commit.
+    """
+    by_device: Dict[str, List[Dict[str, Any]]] = {}
+    for reading in readings:
+        by_device.setdefault(reading["device_id"], []).append(reading)
+
+    for device_id, rows in by_device.items():
+        newest = max(rows, key=lambda r: (r["timestamp_server"], r["id"]))
+        first_seen = min(r["timestamp_server"] for r in rows)
+        seen = newest["timestamp_server"]
+        conn.execute(
+            MERGE_DEVICE_STATE_SQL,
+            {
+                "device_id": device_id,
+                "last_id": newest["id"],
+                "first_seen": first_seen,
+                "last_seen": seen,
+                "firmware_version": newest["firmware_version"],
+                "rssi": newest["rssi"],
+                "message_count": len(rows),
+                "window_start": seen - seen % DEVICE_WINDOW_SECONDS,
+                "last_reading": json.dumps(newest, separators=(",", ":")),
+            },
+        )
+
+        params: Dict[str, Any] = {
+            "device_id": device_id,
+            "message_count": len(rows),
+            "first_seen": first_seen,
+            "last_seen": seen,
+        }
+        for f in STAT_FIELDS:
+            # Flagged values stay out of the stats, as in update_device_stats.
+            values = [
+                float(r[f]) for r in rows if r[f] is not None and not field_flagged(r["quality"], f)
+            ]
+            n = len(values)
+            mean = sum(values) / n if n else 0.0
+            params.update({
+                f"{f}_n": n,
+                f"{f}_mean": mean,
+                f"{f}_m2": sum((v - mean) * (v - mean) for v in values),
+                f"{f}_min": min(values) if n else None,
+                f"{f}_max": max(values) if n else None,
+            })
+        conn.execute(MERGE_DEVICE_STATS_SQL, params)
+
+
+def rebuild_device_stats(conn: sqlite3.Connection) -> None:
+    """
+    Recompute device_stats from the measurements table, leaving out flagged
+    values as ingest does. The sum of squared deviations is taken in a second
+    pass around each device's mean rather than from SUM(x * x), which loses
+    all precision for pressure in Pa.
+    """
+    good = ", ".join(f"{good_value_sql(f)} AS {f}" for f in STAT_FIELDS)
+    firsts = ", ".join(
+        f"COUNT({f}) AS {f}_n, COALESCE(AVG({f}), 0.0) AS {f}_mean, "
+        f"MIN({f}) AS {f}_min, MAX({f}) AS {f}_max"
+        for f in STAT_FIELDS
+    )
+    seconds = ", ".join(
+        f"COALESCE(SUM((m.{f} - a.{f}_mean) * (m.{f} - a.{f}_mean)), 0.0) AS {f}_m2"
+        for f in STAT_FIELDS
+    )
+    columns = ", ".join(
+        f"{f}_n, {f}_mean, {f}_m2, {f}_min, {f}_max" for f in STAT_FIELDS
+    )
+    selected = ", ".join(
+        f"a.{f}_n, a.{f}_mean, s.{f}_m2, a.{f}_min, a.{f}_max" for f in STAT_FIELDS
+    )
+
+    conn.execute("DELETE FROM device_stats")
+    conn.execute(f"""
+        WITH g AS (
+            SELECT device_id, timestamp_server, {good}
+            FROM measurements
+        ),
+        a AS (
+            SELECT
+                device_id,
+                COUNT(*) AS message_count,
+                MIN(timestamp_server) AS first_seen,
+                MAX(timestamp_server) AS last_seen,
+                {firsts}
+            FROM g
+            GROUP BY device_id
+        ),
+        s AS (
+            SELECT m.device_id, {seconds}
+            FROM g m JOIN a ON a.device_id = m.device_id
+            GROUP BY m.device_id
+        )
+        INSERT INTO device_stats (device_id, message_count, first_seen, last_seen, {columns})
+        SELECT a.device_id, a.message_count, a.first_seen, a.last_seen, {selected}
+        FROM a JOIN s ON s.device_id = a.device_id
+    """)
+    conn.commit()
+
+
+def rebuild_device_state(conn: sqlite3.Connection) -> None:
+    """Recompute device_state from the measurements table."""
+    cursor = conn.cursor()
+    cursor.row_factory = sqlite3.Row
+
+    now = int(time.time())
+    window_start = now - now % DEVICE_WINDOW_SECONDS
+
+    devices = cursor.execute("""
+        SELECT device_id, MIN(timestamp_server) AS first_seen, COUNT(*) AS message_count
+        FROM measurements
+        GROUP BY device_id
+    """).fetchall()
+
+    cursor.execute("DELETE FROM device_state")
+    for device in devices:
+        latest = cursor.execute(
+            """
+            SELECT *
+            FROM measurements
+            WHERE device_id = ?
+            ORDER BY timestamp_server DESC, id DESC
+            LIMIT 1
+            """,
+            (device["device_id"],),
+        ).fetchone()
+        window = cursor.execute(
+            """
+            SELECT
+                COUNT(*) FILTER (WHERE timestamp_server >= :start) AS current,
+                COUNT(*) FILTER (WHERE timestamp_server < :start) AS previous
+            FROM measurements
+            WHERE device_id = :device_id AND timestamp_server >= :start - :length
+            """,
+            {
+                "device_id": device["device_id"],
+                "start": window_start,
+                "length": DEVICE_WINDOW_SECONDS,
+            },
+        ).fetchone()
+
+        update_device_state(conn, dict(latest))
+        cursor.execute(
+            """
+            UPDATE device_state
+            SET first_seen = ?, message_count = ?,
+                window_start = ?, window_count = ?, prev_window_count = ?
+            WHERE device_id = ?
+            """,
+            (
+                device["first_seen"],
+                device["message_count"],
+                window_start,
+                window["current"],
+                window["previous"],
+                device["device_id"],
+            ),
+        )
+    conn.commit()
+
+
+# ----------------------------
+# Reads
+# ----------------------------
+
+
+def field_summary(stats: Dict[str, Any], field: str) -> Dict[str, Any]:
+    """Count, mean, sample standard deviation, min and max of one field."""
+    n = stats[f"{field}_n"]
+    if not n:
+        return {"count": 0, "mean": None, "std": None, "min": None, "max": None}
+    mean = stats[f"{field}_mean"]
+    std = (stats[f"{field}_m2"] / (n - 1)) ** 0.5 if n > 1 else 0.0
+    return {
+        "count": n,
+        "mean": mean,
+        "std": std,
+        "min": stats[f"{field}_min"],
+        "max": stats[f"{field}_max"],
+    }
+
+
+def recent_message_count(state: Dict[str, Any], now: int) -> int:
+    """
+    Estimate messages received in the last DEVICE_WINDOW_SECONDS from the two
+    tumbling window counters, weighting the previous window by how much of it
+    still overlaps the sliding window.
+    """
+    current_start = now - now % DEVICE_WINDOW_SECONDS
+    if state["window_start"] == current_start:
+        current, previous = state["window_count"], state["prev_window_count"]
+    elif state["window_start"] == current_start - DEVICE_WINDOW_SECONDS:
+        current, previous = 0, state["window_count"]
+    else:
+        return 0
+
+    overlap = 1 - (now - current_start) / DEVICE_WINDOW_SECONDS
+    return current + round(previous * overlap)
+
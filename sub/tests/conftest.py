@@ -0,0 +1,18 @@
+import sqlite3
+import sys
+from pathlib import Path
+
+import pytest
+
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+
+from storage import init_db  # noqa: E402
+
+
+@pytest.fixture
+def conn(tmp_path):
+    """A fresh database with the current schema."""
+    conn = sqlite3.connect(tmp_path / "environment_data.db")
+    init_db(conn)
+    yield conn
+    conn.close()
@@ -0,0 +1,57 @@
+import time
+
+import pytest
+
+from alerts import AlertEngine, Rule
+from storage import insert_measurement, measurement_from_payload
+
+HOT = {"name": "hot", "type": "threshold", "field": "bmp280_temperature_c", "op": ">", "value": 35}
+FALLING = {"name": "falling", "type": "rate", "field": "bmp280_pressure_pa",
+           "window": 3600, "op": "<=", "value": -300}
+
+
+class RecordingSink:
+    def __init__(self):
+        self.alerts = []
+
+    def send(self, alert):
+        self.alerts.append((alert["status"], alert["rule"], alert["device_id"]))
+
+
+def reading(conn, temperature, ts):
+    payload = {
+        "device_id": "esp32-test",
+        "ts_device": ts,
+        "bmp280": {"temperature_c": temperature, "pressure_pa": 101325.0},
+    }
+    measurement = measurement_from_payload("sensors/esp32-test/environment", payload, ts)
+    stored, _ = insert_measurement(conn, measurement)
+    conn.commit()
+    return stored
+
+
+@pytest.mark.parametrize(
+    "specs, age",
+    [
+        ([HOT], 60),
+        # The last reading is older than every window, so none is replayed.
+        ([HOT, FALLING], 2 * 3600),
+    ],
+)
+def test_firing_alert_is_not_sent_again_after_restart(conn, specs, age):
+    rules = [Rule(spec) for spec in specs]
+    now = int(time.time())
+
+    before = RecordingSink()
+    engine = AlertEngine(rules, before)
+    engine.evaluate(reading(conn, 40.0, now - age))
+    assert before.alerts == [("firing", "hot", "esp32-test")]
+
+    after = RecordingSink()
+    restarted = AlertEngine(rules, after)
+    restarted.warm(conn)
+    restarted.evaluate(reading(conn, 41.0, now))
+    assert after.alerts == []
+
+    restarted.evaluate(reading(conn, 20.0, now + 60))
+    assert after.alerts == [("resolved", "hot", "esp32-test")]
@@ -0,0 +1,54 @@
+import pytest
+
+from export import COLUMN_TYPES, ArrowWriter, export_query, make_writer
+from storage import MEASUREMENT_COLUMNS, insert_measurement, measurement_from_payload
+
+pa = pytest.importorskip("pyarrow")
+pq = pytest.importorskip("pyarrow.parquet")
+
+
+def store(conn, quality):
+    payload = {
+        "device_id": "esp32-test",
+        "fw": "1.0.0",
+        "ts_device": 1760000000,
+        "rssi": -60,
+        "dht22": {"temperature_c": 21.5, "humidity_percent": 48.0},
+        "bmp280": {"temperature_c": 22.0, "pressure_pa": 101325.0},
+    }
+    measurement = measurement_from_payload("sensors/esp32-test/environment", payload, 1760000000)
+    measurement["quality"] = quality
+    insert_measurement(conn, measurement)
+    conn.commit()
+
+
+def export(conn, fmt):
+    query, params = export_query([], None, None)
+    cursor = conn.execute(query, params)
+    writer = make_writer(fmt)
+    data = writer.begin([d[0] for d in cursor.description])
+    data += writer.write(cursor.fetchall())
+    return data + writer.end()
+
+
+def test_every_column_has_a_type():
+    assert set(("id", *MEASUREMENT_COLUMNS)) <= set(COLUMN_TYPES)
+
+
+@pytest.mark.parametrize("fmt", ["arrow", "parquet"])
+def test_export_keeps_quality(conn, fmt):
+    store(conn, 0)
+    store(conn, 5)
+    data = export(conn, fmt)
+    if fmt == "arrow":
+        table = pa.ipc.open_stream(data).read_all()
+    else:
+        table = pq.read_table(pa.BufferReader(data))
+    assert table.schema.field("quality").type == pa.int64()
+    assert table.column("quality").to_pylist() == [0, 5]
+    assert table.column("device_id").to_pylist() == ["esp32-test"] * 2
+
+
+def test_unknown_column_is_an_error():
+    with pytest.raises(ValueError, match="no_such_column"):
+        ArrowWriter("arrow").begin(["id", "no_such_column"])
@@ -0,0 +1,67 @@
+import json
+from types import SimpleNamespace
+
+import pytest
+
+import main
+from storage import measurement_from_payload
+
+
+class NullNotifier:
+    def send(self, kind, data):
+        pass
+
+
+def payload(device_id="esp32-test", **fields):
+    message = {
+        "device_id": device_id,
+        "fw": "1.0.0",
+        "ts_device": 1760000000,
+        "rssi": -60,
+        "dht22": {"temperature_c": 21.5, "humidity_percent": 48.0},
+        "bmp280": {"temperature_c": 22.0, "pressure_pa": 101325.0},
+    }
+    message.update(fields)
+    return message
+
+
+def message(body):
+    return SimpleNamespace(topic="sensors/esp32-test/environment", payload=body.encode())
+
+
+def test_valid_payload_is_parsed():
+    assert main.parse_message(message(json.dumps(payload())), 1760000000) is not None
+
+
+@pytest.mark.parametrize(
+    "body",
+    [
+        json.dumps(payload(rssi="inf")),
+        json.dumps(payload(rssi="-60")),
+        json.dumps(payload(rssi=True)),
+        json.dumps(payload(dht22={"temperature_c": "inf", "humidity_percent": 48.0})),
+        '{"device_id": "esp32-test", "ts_device": 1760000000, "bmp280": {"pressure_pa": NaN}}',
+        '{"device_id": "esp32-test", "ts_device": 1760000000, "altitude_m": Infinity}',
+        '{"device_id": "esp32-test", "ts_device": 1760000000, "free_heap": 1e999}',
+    ],
+)
+def test_non_finite_or_non_numeric_values_are_rejected(body):
+    assert main.parse_message(message(body), 1760000000) is None
+
+
+def test_constraint_error_rejects_the_row_not_the_batch(conn):
+    # rssi "inf", had it got past parsing, is not range-checked as a string
+    # but becomes float("inf") in the device's stats; its next reading then
+    # computes a NaN mean, stored as NULL in a NOT NULL column.
+    poisoned = measurement_from_payload("sensors/esp32-bad/environment", payload("esp32-bad"), 1760000000)
+    poisoned["rssi"] = "inf"
+    batch = [poisoned]
+    for i in range(6):
+        device_id = "esp32-bad" if i == 0 else f"esp32-ok-{i}"
+        batch.append(measurement_from_payload(f"sensors/{device_id}/environment", payload(device_id), 1760000060))
+
+    main.store_batch(conn, batch, NullNotifier())
+
+    assert not conn.in_transaction
+    stored = dict(conn.execute("SELECT device_id, COUNT(*) FROM measurements GROUP BY device_id").fetchall())
+    assert stored == {"esp32-bad": 1, **{f"esp32-ok-{i}": 1 for i in range(1, 6)}}
@@ -0,0 +1,59 @@
+import asyncio
+import json
+
+import pytest
+
+from notify import NotificationHub
+
+
+def measurement(measurement_id=1):
+    return {
+        "event": "measurement",
+        "data": {
+            "reading": {"id": measurement_id, "device_id": "esp32-test"},
+            "device": {
+                "device_id": "esp32-test",
+                "last_seen": 1760000000,
+                "message_count": 1,
+                "window_start": 1759999800,
+                "window_count": 1,
+                "prev_window_count": 0,
+                "firmware_version": "1.0.0",
+                "rssi": -60,
+                "rssi_avg": -60.0,
+            },
+        },
+    }
+
+
+@pytest.mark.parametrize(
+    "datagram",
+    [
+        b"not json",
+        b"[1, 2]",
+        b'{"event": "measurement"}',
+        b'{"event": "measurement", "data": []}',
+        b'{"event": "measurement", "data": {"reading": "x", "device": {}}}',
+        json.dumps({**measurement(), "event": "other"}).encode(),
+        json.dumps({"event": "measurement", "data": {**measurement()["data"], "device": {}}}).encode(),
+    ],
+)
+def test_malformed_notifications_are_dropped(datagram):
+    async def run():
+        hub = NotificationHub()
+        queue = hub.subscribe()
+        hub.datagram_received(datagram, ("127.0.0.1", 9))
+        return hub.changes, queue.qsize()
+
+    assert asyncio.run(run()) == (0, 0)
+
+
+def test_notifications_are_forwarded_and_counted():
+    async def run():
+        hub = NotificationHub()
+        queue = hub.subscribe()
+        hub.datagram_received(json.dumps(measurement(2**62)).encode(), ("127.0.0.1", 9))
+        hub.datagram_received(json.dumps(measurement(5)).encode(), ("127.0.0.1", 9))
+        return hub.changes, [queue.get_nowait()["data"]["reading"]["id"] for _ in range(queue.qsize())]
+
+    assert asyncio.run(run()) == (2, [2**62, 5])
@@ -0,0 +1,12 @@
+from storage import insert_measurement, measurement_from_payload, rebuild_device_state
+
+
+def test_rebuild_picks_the_same_latest_row_within_one_second(conn):
+    for rssi in (-70, -60, -50):
+        payload = {"device_id": "esp32-test", "ts_device": 1760000000, "rssi": rssi}
+        insert_measurement(conn, measurement_from_payload("sensors/esp32-test/environment", payload, 1760000000))
+    conn.commit()
+    incremental = conn.execute("SELECT last_id, rssi, last_reading FROM device_state").fetchall()
+
+    rebuild_device_state(conn)
+    assert conn.execute("SELECT last_id, rssi, last_reading FROM device_state").fetchall() == incremental
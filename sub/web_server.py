@@ -1,22 +1,66 @@
+import asyncio
+import hmac
+import json
 import os
 import sqlite3
 import time
+import weakref
+from contextlib import asynccontextmanager
+from contextvars import ContextVar
 from datetime import datetime, timedelta
-from typing import List, Optional, Dict, Any
+from typing import List, Optional, Dict, Any, Sequence
 from pathlib import Path
 
 from fastapi import FastAPI, HTTPException, Query
-from fastapi.responses import HTMLResponse, JSONResponse
-from fastapi.staticfiles import StaticFiles
+from fastapi.responses import HTMLResponse, JSONResponse, Response, StreamingResponse
 from fastapi.templating import Jinja2Templates
 from fastapi.requests import Request
 from dotenv import load_dotenv
 import logging
 
+import metrics
+from backup import BACKUP_DIR, Snapshotter
+from columnar import columnar_series, columns_from_cursor, columns_from_rows, selected_columns
+from db_pool import QueryTimeout, ReadPool
+from downsample import SERIES_FIELDS, downsample_rows
+from export import MEDIA_TYPES, export_query, make_writer
+from http_cache import CompressionMiddleware, StaticAssets, etag_matches
+from notify import NotificationHub
+from paging import MAX_INT, ORDERS, InvalidCursor, PageQuery
+from quality import good_value_sql
+from storage import (
+    DEVICE_WINDOW_SECONDS,
+    MEASUREMENT_COLUMNS,
+    STAT_FIELDS,
+    field_summary,
+    recent_message_count,
+)
+
 # Load environment variables
 load_dotenv()
 
 SQLITE_DB = os.getenv("SQLITE_DB", "environment_data.db")
+DB_POOL_SIZE = int(os.getenv("DB_POOL_SIZE", "4"))
+DB_MMAP_SIZE = int(os.getenv("DB_MMAP_SIZE", str(64 * 1024 * 1024)))
+DB_CACHED_STATEMENTS = int(os.getenv("DB_CACHED_STATEMENTS", "256"))
+DB_QUERY_TIMEOUT = float(os.getenv("DB_QUERY_TIMEOUT", "5"))
+NOTIFY_HOST = os.getenv("NOTIFY_HOST", "127.0.0.1")
+NOTIFY_PORT = int(os.getenv("NOTIFY_PORT", "8765"))
+STREAM_HEARTBEAT = 15  # seconds between keepalive comments on idle streams
+QUERY_TIMEOUT = float(os.getenv("QUERY_TIMEOUT", "10"))
+QUERY_MAX_ROWS = int(os.getenv("QUERY_MAX_ROWS", "10000"))
+QUERY_MAX_BYTES = int(os.getenv("QUERY_MAX_BYTES", str(8 * 1024 * 1024)))
+QUERY_MAX_CONCURRENT = int(os.getenv("QUERY_MAX_CONCURRENT", "2"))
+EXPORT_TIMEOUT = float(os.getenv("EXPORT_TIMEOUT", "0"))  # 0 = no limit
+EXPORT_BATCH_SIZE = int(os.getenv("EXPORT_BATCH_SIZE", "5000"))
+# ETags of responses covering "the last N hours" also change every this many
+# seconds, so rows leaving the window show up even when nothing new arrives.
+ETAG_WINDOW = 60
+# Bearer token for /api/admin/*; the endpoints are disabled while it is empty.
+ADMIN_TOKEN = os.getenv("ADMIN_TOKEN", "")
+BACKUP_INTERVAL_HOURS = float(os.getenv("BACKUP_INTERVAL_HOURS", "0"))  # 0 = no schedule
+# Pause before the schedule tries again after an unexpected error.
+BACKUP_RETRY_SECONDS = 60
 LOG_LEVEL = os.getenv("LOG_LEVEL", "INFO").upper()
 
 logging.basicConfig(
@@ -24,248 +68,723 @@ logging.basicConfig(
     format="%(asctime)s [%(levelname)s] %(message)s",
 )
 
-app = FastAPI(title="Meteo Dashboard", version="1.0.0")
+# ----------------------------
+# Request metrics
+# ----------------------------
+
+request_seconds = metrics.Histogram(
+    "meteo_http_request_duration_seconds",
+    "Time from request to the last byte of the response.",
+    ("route", "method", "status"),
+)
+sqlite_seconds = metrics.Histogram(
+    "meteo_http_sqlite_seconds",
+    "Time a request spent running SQLite queries.",
+    ("route",),
+)
+
+# SQLite time of the request being handled, [seconds]; None outside requests.
+request_sqlite_time: ContextVar[Optional[List[float]]] = ContextVar("request_sqlite_time", default=None)
+
+
+def add_sqlite_time(seconds: float) -> None:
+    spent = request_sqlite_time.get()
+    if spent is not None:
+        spent[0] += seconds
+
+
+class MetricsMiddleware:
+    """
+    Record each request's duration and SQLite time by route template, so
+    /api/devices/{device_id}/latest is one series rather than one per device.
+    Server-sent event streams stay open for hours and are left out.
+    """
+
+    def __init__(self, app):
+        self.app = app
+
+    async def __call__(self, scope, receive, send):
+        if scope["type"] != "http":
+            await self.app(scope, receive, send)
+            return
+
+        started = time.perf_counter()
+        spent = [0.0]
+        token = request_sqlite_time.set(spent)
+        status = 500
+        streaming = False
+
+        async def send_wrapper(message):
+            nonlocal status, streaming
+            if message["type"] == "http.response.start":
+                status = message["status"]
+                for name, value in message.get("headers", ()):
+                    if name.lower() == b"content-type" and value.startswith(b"text/event-stream"):
+                        streaming = True
+            await send(message)
+
+        try:
+            await self.app(scope, receive, send_wrapper)
+        finally:
+            request_sqlite_time.reset(token)
+            if not streaming:
+                # Unmatched paths share one label, whatever a scanner requests.
+                route = getattr(scope.get("route"), "path", "unmatched")
+                request_seconds.labels(route, scope["method"], str(status)).observe(
+                    time.perf_counter() - started
+                )
+                sqlite_seconds.labels(route).observe(spent[0])
+
+
+db = ReadPool(
+    SQLITE_DB,
+    size=DB_POOL_SIZE,
+    mmap_size=DB_MMAP_SIZE,
+    cached_statements=DB_CACHED_STATEMENTS,
+    timeout=DB_QUERY_TIMEOUT,
+    on_query=add_sqlite_time,
+)
+
+
+hub = NotificationHub()
+
+# Ad-hoc console queries each hold their own connection and thread.
+query_slots = asyncio.Semaphore(QUERY_MAX_CONCURRENT)
+
+# Online snapshots (backup.py), on a schedule and through /api/admin/backup.
+snapshotter = Snapshotter(SQLITE_DB, BACKUP_DIR)
+
+
+async def backup_schedule(interval: float) -> None:
+    """Start a snapshot every `interval` seconds, counting from the newest on disk."""
+    last_attempt = 0.0
+    while True:
+        try:
+            snapshots = snapshotter.snapshots()
+            newest = snapshots[-1].stat().st_mtime if snapshots else 0.0
+            # A failed attempt also waits a full interval before the next one.
+            due = max(newest, last_attempt) + interval
+            await asyncio.sleep(max(0.0, due - time.time()))
+            last_attempt = time.time()
+            if snapshotter.start() is None:
+                logging.info("Scheduled backup skipped, one is already running")
+            while snapshotter.running:
+                await asyncio.sleep(5)
+        except Exception as e:
+            # E.g. an unreadable backup directory; the schedule must outlive it.
+            logging.exception(f"Backup schedule error: {e}")
+            await asyncio.sleep(BACKUP_RETRY_SECONDS)
+
+
+@asynccontextmanager
+async def lifespan(app: FastAPI):
+    try:
+        await hub.start(NOTIFY_HOST, NOTIFY_PORT)
+    except OSError as e:
+        logging.warning(f"Live updates disabled, cannot listen on {NOTIFY_HOST}:{NOTIFY_PORT}: {e}")
+    schedule = None
+    if BACKUP_INTERVAL_HOURS > 0:
+        schedule = asyncio.create_task(backup_schedule(BACKUP_INTERVAL_HOURS * 3600))
+    yield
+    if schedule is not None:
+        schedule.cancel()
+    hub.close()
+    db.close()
+
+
+app = FastAPI(title="Meteo Dashboard", version="1.0.0", lifespan=lifespan)
+app.add_middleware(CompressionMiddleware)
+# Added last so it runs outermost and times compression too.
+app.add_middleware(MetricsMiddleware)
 
 # Setup templates and static files
 BASE_DIR = Path(__file__).resolve().parent
-templates = Jinja2Templates(directory=str(BASE_DIR / "templates"))
 
 # Create static directory if it doesn't exist
 static_dir = BASE_DIR / "static"
 static_dir.mkdir(exist_ok=True)
-app.mount("/static", StaticFiles(directory=str(static_dir)), name="static")
+assets = StaticAssets(static_dir)
+
+templates = Jinja2Templates(directory=str(BASE_DIR / "templates"))
+templates.env.globals["static_url"] = assets.url
 
 
-def get_db_connection():
-    """Create a database connection."""
-    conn = sqlite3.connect(SQLITE_DB, check_same_thread=False)
-    conn.row_factory = sqlite3.Row
-    return conn
+@app.exception_handler(QueryTimeout)
+async def query_timeout_handler(request: Request, exc: QueryTimeout):
+    logging.warning(f"{request.url.path}: {exc}")
+    return JSONResponse(status_code=504, content={"detail": str(exc)})
 
 
 @app.get("/meteo", response_class=HTMLResponse)
 async def dashboard(request: Request):
     """Main dashboard page."""
-    return templates.TemplateResponse("dashboard.html", {"request": request})
+    return templates.TemplateResponse(
+        request, "dashboard.html", headers={"Cache-Control": "no-cache"}
+    )
+
+
+@app.get("/static/{path:path}")
+async def static_file(path: str, request: Request):
+    """Files in static/, long-cached under the fingerprinted names in the page."""
+    return assets.response(path, request.headers)
+
+
+version_read_at = 0.0
+# hub.changes at the last read, and the value read.
+version_changes = -1
+version_value = 0
+
+
+async def data_version() -> int:
+    """
+    Id of the last ingested measurement, read from id_sequence. It is
+    re-read when a notification says data changed, once per ETAG_WINDOW to
+    catch lost notifications, or every time if live updates are disabled.
+    Notifications are unauthenticated, so their ids are never used directly:
+    a forged one costs a read, and a database restored with lower ids still
+    changes the version.
+    """
+    global version_read_at, version_changes, version_value
+    now = time.monotonic()
+    if hub.transport is None or hub.changes != version_changes or now - version_read_at > ETAG_WINDOW:
+        changes = hub.changes
+        try:
+            row = await db.fetchone("SELECT value FROM id_sequence WHERE name = 'measurements'")
+        except sqlite3.OperationalError:
+            # Database not yet opened by a main.py that keeps id_sequence;
+            # the old rowid table answers MAX(id) from the end of its B-tree.
+            row = await db.fetchone("SELECT COALESCE(MAX(id), 0) AS value FROM measurements")
+        version_value = row["value"] if row else 0
+        version_changes = changes
+        version_read_at = now
+    return version_value
+
+
+async def not_modified(request: Request, response: Response, window: bool = False) -> Optional[Response]:
+    """
+    Tag the response with the data version and return a 304 if the client
+    already has it. Call before querying: a match costs no database work.
+    """
+    version = str(await data_version())
+    if window:
+        version += f"-{int(time.time()) // ETAG_WINDOW}"
+    headers = {"ETag": f'W/"{version}"', "Cache-Control": "no-cache"}
+
+    if etag_matches(request.headers.get("if-none-match"), headers["ETag"]):
+        return Response(status_code=304, headers=headers)
+    response.headers.update(headers)
+    return None
+
+
+def json_response(content: Dict[str, Any], response: Response) -> JSONResponse:
+    """
+    Serialize directly, skipping FastAPI's per-value jsonable_encoder pass;
+    for plain lists of numbers and strings it only costs time. Keeps the
+    headers set on `response`.
+    """
+    return JSONResponse(content, headers=dict(response.headers))
+
+
+ROW_COLUMNS = ("id",) + MEASUREMENT_COLUMNS
+FORMAT_PATTERN = "^(rows|columnar)$"
+
+# quality=good leaves out rows with any quality flag, quality=flagged returns
+# only those (read through the partial index of flagged rows).
+QUALITY_CONDITIONS = {"all": None, "good": "quality = 0", "flagged": "quality != 0"}
+QUALITY_PATTERN = "^(all|good|flagged)$"
+
+
+def row_columns(fields: Optional[str]) -> str:
+    """SELECT list for row endpoints: every column, or id, device, time and `fields`."""
+    try:
+        selected = selected_columns(fields, ROW_COLUMNS)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=str(e))
+    if not selected:
+        return "*"
+    return ", ".join(dict.fromkeys(["id", "device_id", "timestamp_server", *selected]))
+
+
+def columnar_rows(query: str, params: Sequence[Any], delta: bool):
+    return db.run(lambda conn: columns_from_cursor(conn.execute(query, params), delta))
+
+
+def device_status(state, current_time: int) -> Dict[str, Any]:
+    """Shape a device_state row for the dashboard's device cards."""
+    last_seen = state["last_seen"]
+    seconds_ago = current_time - last_seen
+
+    # Determine status
+    if seconds_ago < 60:
+        status = "online"
+    elif seconds_ago < 300:
+        status = "warning"
+    else:
+        status = "offline"
+
+    return {
+        "device_id": state["device_id"],
+        "status": status,
+        "last_seen": last_seen,
+        "last_seen_ago": seconds_ago,
+        "message_count": recent_message_count(state, current_time),
+        "message_count_total": state["message_count"],
+        "firmware_version": state["firmware_version"],
+        "rssi": state["rssi"],
+        "rssi_avg": round(state["rssi_avg"], 1) if state["rssi_avg"] is not None else None,
+    }
 
 
 @app.get("/api/devices/status")
 async def get_devices_status():
     """Get currently connected devices and their status."""
-    conn = get_db_connection()
-    cursor = conn.cursor()
-
     # Get devices that have sent data in the last 5 minutes
     five_minutes_ago = int(time.time()) - 300
 
     query = """
-        SELECT 
+        SELECT
             device_id,
-            MAX(timestamp_server) as last_seen,
-            COUNT(*) as message_count,
+            last_seen,
+            message_count,
+            window_start,
+            window_count,
+            prev_window_count,
             firmware_version,
-            rssi
-        FROM measurements
-        WHERE timestamp_server > ?
-        GROUP BY device_id
+            rssi,
+            rssi_avg
+        FROM device_state
+        WHERE last_seen > ?
         ORDER BY last_seen DESC
     """
 
-    cursor.execute(query, (five_minutes_ago,))
-    rows = cursor.fetchall()
+    rows = await db.fetchall(query, (five_minutes_ago,))
 
-    devices = []
     current_time = int(time.time())
+    devices = [device_status(row, current_time) for row in rows]
 
-    for row in rows:
-        last_seen = row["last_seen"]
-        seconds_ago = current_time - last_seen
-
-        # Determine status
-        if seconds_ago < 60:
-            status = "online"
-        elif seconds_ago < 300:
-            status = "warning"
-        else:
-            status = "offline"
-
-        devices.append(
-            {
-                "device_id": row["device_id"],
-                "status": status,
-                "last_seen": last_seen,
-                "last_seen_ago": seconds_ago,
-                "message_count": row["message_count"],
-                "firmware_version": row["firmware_version"],
-                "rssi": row["rssi"],
-            }
-        )
-
-    conn.close()
     return {"devices": devices, "timestamp": current_time}
 
 
 @app.get("/api/devices/{device_id}/latest")
-async def get_device_latest_data(device_id: str):
+async def get_device_latest_data(device_id: str, request: Request, response: Response):
     """Get latest data from a specific device."""
-    conn = get_db_connection()
-    cursor = conn.cursor()
+    if cached := await not_modified(request, response):
+        return cached
 
     query = """
-        SELECT *
-        FROM measurements
+        SELECT last_reading
+        FROM device_state
         WHERE device_id = ?
-        ORDER BY timestamp_server DESC
-        LIMIT 1
     """
 
-    cursor.execute(query, (device_id,))
-    row = cursor.fetchone()
-    conn.close()
+    row = await db.fetchone(query, (device_id,))
 
     if not row:
         raise HTTPException(status_code=404, detail=f"Device {device_id} not found")
 
-    return dict(row)
+    return json.loads(row["last_reading"])
 
 
 @app.get("/api/data/latest")
-async def get_latest_data(limit: int = Query(default=10, ge=1, le=100)):
-    """Get latest measurements from all devices."""
-    conn = get_db_connection()
-    cursor = conn.cursor()
+async def get_latest_data(
+    request: Request,
+    response: Response,
+    limit: int = Query(default=10, ge=1, le=100),
+    format: str = Query("rows", pattern=FORMAT_PATTERN),
+    delta: bool = False,
+    fields: Optional[str] = None,
+    quality: str = Query("all", pattern=QUALITY_PATTERN),
+):
+    """
+    Get latest measurements from all devices. `format=columnar` returns one
+    array per column (see columnar.py) instead of one object per row, and
+    `fields` narrows the columns.
+    """
+    if cached := await not_modified(request, response):
+        return cached
 
-    query = """
-        SELECT *
+    condition = QUALITY_CONDITIONS[quality]
+    query = f"""
+        SELECT {row_columns(fields)}
         FROM measurements
+        {f"WHERE {condition}" if condition else ""}
         ORDER BY timestamp_server DESC
         LIMIT ?
     """
 
-    cursor.execute(query, (limit,))
-    rows = cursor.fetchall()
-    conn.close()
+    if format == "columnar":
+        return json_response(await columnar_rows(query, (limit,), delta), response)
+
+    rows = await db.fetchall(query, (limit,))
 
     return {"data": [dict(row) for row in rows]}
 
 
+# Per-device time ranges are primary key seeks in the clustered layout;
+# spelling out the device list lets cross-device reads use them too instead
+# of scanning every device's full history.
+ALL_DEVICES = "SELECT device_id FROM device_state"
+
+
+def history_series(
+    conn: sqlite3.Connection,
+    device_id: Optional[str],
+    start: int,
+    end: Optional[int],
+    fields: List[str],
+    points: int,
+) -> Dict[str, Dict[str, List]]:
+    # Field names are validated against SERIES_FIELDS before being inlined.
+    # Values flagged at ingest read as NULL, which the filter drops.
+    columns = ", ".join(f"{good_value_sql(f)} AS {f}" for f in fields)
+    where = f"device_id IN ({ALL_DEVICES}) AND timestamp_server >= ?"
+    params: List[Any] = [start]
+    if device_id:
+        where = "device_id = ? AND timestamp_server >= ?"
+        params.insert(0, device_id)
+    if end is not None:
+        where += " AND timestamp_server < ?"
+        params.append(end)
+
+    cursor = conn.execute(
+        f"""
+        SELECT device_id, timestamp_server, {columns}
+        FROM measurements
+        WHERE {where}
+        ORDER BY device_id, timestamp_server
+        """,
+        params,
+    )
+    # Plain tuples, no sqlite3.Row per sample.
+    cursor.row_factory = None
+    return downsample_rows(cursor, fields, points)
+
+
+def history_page(
+    conn: sqlite3.Connection, page: PageQuery, columns: str, limit: int, columnar: bool, delta: bool
+) -> Dict[str, Any]:
+    """One page of history rows, with the token for the next page if there is one."""
+    query, params = page.sql(columns, QUALITY_CONDITIONS[page.quality], limit + 1)
+    cursor = conn.execute(query, params)
+    cursor.row_factory = None
+    names = [d[0] for d in cursor.description]
+    rows = cursor.fetchall()
+
+    # One row more than asked for tells whether another page follows.
+    next_cursor = None
+    if len(rows) > limit:
+        rows = rows[:limit]
+        last = rows[-1]
+        next_cursor = page.token((last[names.index("timestamp_server")], last[names.index("id")]))
+
+    if columnar:
+        content = columns_from_rows(names, rows, delta)
+    else:
+        content = {"data": [dict(zip(names, row)) for row in rows]}
+    content["next_cursor"] = next_cursor
+    return content
+
+
 @app.get("/api/data/history")
 async def get_historical_data(
+    request: Request,
+    response: Response,
     device_id: Optional[str] = None,
-    hours: int = Query(default=24, ge=1, le=168),
+    hours: int = Query(default=24, ge=1),
+    start: Optional[int] = Query(default=None, ge=0, le=MAX_INT),
+    end: Optional[int] = Query(default=None, ge=0, le=MAX_INT),
     limit: int = Query(default=1000, ge=1, le=10000),
+    order: str = Query("desc", pattern=f"^({'|'.join(ORDERS)})$"),
+    cursor: Optional[str] = None,
+    points: Optional[int] = Query(default=None, ge=10, le=5000),
+    fields: Optional[str] = None,
+    format: str = Query("rows", pattern=FORMAT_PATTERN),
+    delta: bool = False,
+    quality: str = Query("all", pattern=QUALITY_PATTERN),
 ):
-    """Get historical data with optional device filter."""
-    conn = get_db_connection()
-    cursor = conn.cursor()
-
-    time_threshold = int(time.time()) - (hours * 3600)
-
-    if device_id:
-        query = """
-            SELECT *
-            FROM measurements
-            WHERE device_id = ? AND timestamp_server > ?
-            ORDER BY timestamp_server DESC
-            LIMIT ?
-        """
-        cursor.execute(query, (device_id, time_threshold, limit))
+    """
+    Get historical data with optional device filter.
+
+    The time range is `start` (inclusive) to `end` (exclusive) in unix
+    seconds; a missing `start` is `hours` before `end`, or before now.
+
+    With `points`, returns per-device series of the comma separated `fields`
+    instead of rows: outliers removed and each series LTTB-downsampled to at
+    most `points` points, so the response size follows the chart width rather
+    than the amount of stored data.
+
+    Without `points`, rows come in pages of `limit`, newest first or oldest
+    first with `order=asc`. `next_cursor` in the response is null on the last
+    page; otherwise pass it as `cursor` to get the next one, which repeats
+    the device, time range, quality and order of the first request (those
+    parameters are ignored alongside a cursor). `fields` narrows the returned
+    columns and `quality` selects all, only clean (`good`) or only flagged
+    rows. Series always leave out values flagged at ingest.
+    `format=columnar` returns rows as one array per column and series as
+    {"t": [...], "v": [...]} per field; `delta=true` delta-encodes the
+    integer columns and series timestamps.
+    """
+    if cached := await not_modified(request, response, window=True):
+        return cached
+
+    if start is None:
+        start = max(0, (int(time.time()) if end is None else end) - hours * 3600)
+
+    if points is not None:
+        if cursor:
+            raise HTTPException(status_code=400, detail="cursor pages rows, not series")
+        selected = fields.split(",") if fields else list(SERIES_FIELDS)
+        unknown = [f for f in selected if f not in SERIES_FIELDS]
+        if unknown:
+            raise HTTPException(status_code=400, detail=f"Unknown fields: {', '.join(unknown)}")
+
+        series = await db.run(
+            lambda conn: history_series(conn, device_id, start, end, selected, points)
+        )
+        if format == "columnar":
+            content = {
+                "format": "columnar",
+                "series": columnar_series(series, delta),
+                "fields": selected,
+                "points": points,
+                "hours": hours,
+                "delta": ["t"] if delta else [],
+            }
+            return json_response(content, response)
+        return {"series": series, "fields": selected, "points": points, "hours": hours}
+
+    if cursor:
+        try:
+            page = PageQuery.from_token(cursor, QUALITY_CONDITIONS)
+        except InvalidCursor as e:
+            raise HTTPException(status_code=400, detail=str(e))
     else:
-        query = """
-            SELECT *
-            FROM measurements
-            WHERE timestamp_server > ?
-            ORDER BY timestamp_server DESC
-            LIMIT ?
-        """
-        cursor.execute(query, (time_threshold, limit))
-
-    rows = cursor.fetchall()
-    conn.close()
-
-    return {"data": [dict(row) for row in rows], "hours": hours}
+        page = PageQuery(device_id, start, end, quality, order)
+
+    columns = row_columns(fields)
+    columnar = format == "columnar"
+    content = await db.run(lambda conn: history_page(conn, page, columns, limit, columnar, delta))
+    content.update(hours=hours, start=page.start, end=page.end)
+    if columnar:
+        return json_response(content, response)
+    return content
+
+
+# Averages leave out values flagged at ingest.
+AGGREGATE_AVERAGES = ",\n".join(
+    f"AVG({good_value_sql(field)}) as {name}"
+    for field, name in (
+        ("dht22_temperature_c", "avg_dht22_temp"),
+        ("dht22_humidity_percent", "avg_dht22_humidity"),
+        ("bmp280_temperature_c", "avg_bmp280_temp"),
+        ("bmp280_pressure_pa", "avg_bmp280_pressure"),
+        ("rssi", "avg_rssi"),
+        ("dew_point_c", "avg_dew_point"),
+        ("absolute_humidity_gm3", "avg_absolute_humidity"),
+        ("pressure_qnh_pa", "avg_pressure_qnh"),
+        ("pressure_tendency_pa_3h", "avg_pressure_tendency"),
+    )
+)
 
 
 @app.get("/api/data/aggregated")
 async def get_aggregated_data(
+    request: Request,
+    response: Response,
     device_id: Optional[str] = None,
     hours: int = Query(default=24, ge=1, le=168),
     interval_minutes: int = Query(default=60, ge=5, le=1440),
 ):
     """Get aggregated data by time intervals."""
-    conn = get_db_connection()
-    cursor = conn.cursor()
+    if cached := await not_modified(request, response, window=True):
+        return cached
 
     time_threshold = int(time.time()) - (hours * 3600)
     interval_seconds = interval_minutes * 60
 
     if device_id:
-        query = """
+        query = f"""
             SELECT 
                 device_id,
                 (timestamp_server / ?) * ? as time_bucket,
-                AVG(dht22_temperature_c) as avg_dht22_temp,
-                AVG(dht22_humidity_percent) as avg_dht22_humidity,
-                AVG(bmp280_temperature_c) as avg_bmp280_temp,
-                AVG(bmp280_pressure_pa) as avg_bmp280_pressure,
-                AVG(rssi) as avg_rssi,
+                {AGGREGATE_AVERAGES},
                 COUNT(*) as sample_count
             FROM measurements
             WHERE device_id = ? AND timestamp_server > ?
             GROUP BY device_id, time_bucket
             ORDER BY time_bucket ASC
         """
-        cursor.execute(query, (interval_seconds, interval_seconds, device_id, time_threshold))
+        rows = await db.fetchall(
+            query, (interval_seconds, interval_seconds, device_id, time_threshold)
+        )
     else:
-        query = """
+        query = f"""
             SELECT 
                 device_id,
                 (timestamp_server / ?) * ? as time_bucket,
-                AVG(dht22_temperature_c) as avg_dht22_temp,
-                AVG(dht22_humidity_percent) as avg_dht22_humidity,
-                AVG(bmp280_temperature_c) as avg_bmp280_temp,
-                AVG(bmp280_pressure_pa) as avg_bmp280_pressure,
-                AVG(rssi) as avg_rssi,
+                {AGGREGATE_AVERAGES},
                 COUNT(*) as sample_count
             FROM measurements
-            WHERE timestamp_server > ?
+            WHERE device_id IN ({ALL_DEVICES}) AND timestamp_server > ?
             GROUP BY device_id, time_bucket
             ORDER BY time_bucket ASC
         """
-        cursor.execute(query, (interval_seconds, interval_seconds, time_threshold))
-
-    rows = cursor.fetchall()
-    conn.close()
+        rows = await db.fetchall(query, (interval_seconds, interval_seconds, time_threshold))
 
     return {"data": [dict(row) for row in rows], "interval_minutes": interval_minutes}
 
 
+@app.get("/api/stream")
+async def stream_updates():
+    """
+    Server-sent events with each measurement as it is ingested ("measurement")
+    followed by the updated status of its device ("device").
+    """
+    queue = hub.subscribe()
+
+    def sse(event: str, data: Any) -> str:
+        return f"event: {event}\ndata: {json.dumps(data, separators=(',', ':'))}\n\n"
+
+    async def events():
+        try:
+            yield "retry: 5000\n\n"
+            while True:
+                try:
+                    message = await asyncio.wait_for(queue.get(), STREAM_HEARTBEAT)
+                except asyncio.TimeoutError:
+                    yield ": keepalive\n\n"
+                    continue
+
+                if message is None:
+                    # Evicted for falling behind, or shutting down.
+                    break
+
+                if message.get("event") == "measurement":
+                    data = message["data"]
+                    yield sse("measurement", data["reading"])
+                    yield sse("device", device_status(data["device"], int(time.time())))
+        finally:
+            hub.unsubscribe(queue)
+
+    return StreamingResponse(
+        events(),
+        media_type="text/event-stream",
+        headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"},
+    )
+
+
+# Device gauges, refreshed from device_state on each scrape.
+device_rows: List[sqlite3.Row] = []
+
+
+def device_samples(value):
+    def samples():
+        now = int(time.time())
+        return [((row["device_id"],), value(row, now)) for row in device_rows]
+
+    return samples
+
+
+API_METRICS: List[metrics.Metric] = [
+    request_seconds,
+    sqlite_seconds,
+    metrics.Callback(
+        "meteo_stream_subscribers",
+        "Open /api/stream connections.",
+        "gauge",
+        lambda: [((), len(hub.subscribers))],
+    ),
+    metrics.Callback(
+        "meteo_device_messages_total",
+        "Messages stored per device.",
+        "counter",
+        device_samples(lambda row, now: row["message_count"]),
+        ("device_id",),
+    ),
+    metrics.Callback(
+        "meteo_device_message_rate",
+        f"Messages per second per device over the last {DEVICE_WINDOW_SECONDS} s.",
+        "gauge",
+        device_samples(lambda row, now: recent_message_count(row, now) / DEVICE_WINDOW_SECONDS),
+        ("device_id",),
+    ),
+    metrics.Callback(
+        "meteo_device_seconds_since_last_seen",
+        "Seconds since the device's last stored message.",
+        "gauge",
+        device_samples(lambda row, now: now - row["last_seen"]),
+        ("device_id",),
+    ),
+    metrics.Callback(
+        "meteo_device_rssi_dbm",
+        "Last reported Wi-Fi signal strength.",
+        "gauge",
+        device_samples(lambda row, now: row["rssi"]),
+        ("device_id",),
+    ),
+    metrics.Callback(
+        "meteo_backup_running",
+        "1 while a database snapshot is being taken.",
+        "gauge",
+        lambda: [((), 1 if snapshotter.running else 0)],
+    ),
+    metrics.Callback(
+        "meteo_backups_total",
+        "Database snapshots taken since start, by outcome.",
+        "counter",
+        lambda: [(("ok",), snapshotter.completed), (("failed",), snapshotter.failed)],
+        ("status",),
+    ),
+    metrics.Callback(
+        "meteo_backup_last_success_timestamp_seconds",
+        "Unix time the last snapshot completed, 0 if none since start.",
+        "gauge",
+        lambda: [((), snapshotter.last_success)],
+    ),
+]
+
+
+@app.get("/metrics")
+async def prometheus_metrics():
+    """Prometheus exposition of API and per-device metrics."""
+    global device_rows
+    device_rows = await db.fetchall(
+        """
+        SELECT device_id, last_seen, message_count, window_start, window_count,
+               prev_window_count, rssi
+        FROM device_state
+        ORDER BY device_id
+        """
+    )
+    return Response(metrics.render(API_METRICS), media_type=metrics.CONTENT_TYPE)
+
+
 @app.get("/api/health")
 async def health_check():
     """Health check endpoint."""
-    try:
-        conn = get_db_connection()
-        cursor = conn.cursor()
 
+    def run(conn: sqlite3.Connection):
         # Check database
-        cursor.execute("SELECT COUNT(*) as count FROM measurements")
-        total_records = cursor.fetchone()["count"]
+        total_records = conn.execute(
+            "SELECT COALESCE(SUM(message_count), 0) as count FROM device_stats"
+        ).fetchone()["count"]
 
         # Check recent activity
         five_minutes_ago = int(time.time()) - 300
-        cursor.execute(
-            "SELECT COUNT(DISTINCT device_id) as active_devices FROM measurements WHERE timestamp_server > ?",
+        active_devices = conn.execute(
+            "SELECT COUNT(*) as active_devices FROM device_state WHERE last_seen > ?",
             (five_minutes_ago,),
-        )
-        active_devices = cursor.fetchone()["active_devices"]
+        ).fetchone()["active_devices"]
 
         # Get database size
-        cursor.execute(
+        db_size = conn.execute(
             "SELECT page_count * page_size as size FROM pragma_page_count(), pragma_page_size()"
-        )
-        db_size = cursor.fetchone()["size"]
+        ).fetchone()["size"]
 
-        conn.close()
+        return total_records, active_devices, db_size
+
+    try:
+        total_records, active_devices, db_size = await db.run(run)
 
         return {
             "status": "healthy",
@@ -283,52 +802,139 @@ async def health_check():
 
 
 @app.get("/api/stats")
-async def get_statistics():
+async def get_statistics(request: Request, response: Response):
     """Get overall statistics."""
-    conn = get_db_connection()
-    cursor = conn.cursor()
-
-    # Get overall stats
-    cursor.execute("""
-        SELECT 
-            COUNT(*) as total_measurements,
-            COUNT(DISTINCT device_id) as total_devices,
-            MIN(timestamp_server) as first_measurement,
-            MAX(timestamp_server) as last_measurement
-        FROM measurements
-    """)
-    stats = dict(cursor.fetchone())
-
-    # Get per-device stats
-    cursor.execute("""
-        SELECT 
-            device_id,
-            COUNT(*) as measurement_count,
-            MIN(timestamp_server) as first_seen,
-            MAX(timestamp_server) as last_seen,
-            AVG(dht22_temperature_c) as avg_temp_dht22,
-            AVG(bmp280_temperature_c) as avg_temp_bmp280,
-            AVG(dht22_humidity_percent) as avg_humidity,
-            AVG(bmp280_pressure_pa) as avg_pressure
-        FROM measurements
-        GROUP BY device_id
-    """)
-    device_stats = [dict(row) for row in cursor.fetchall()]
+    if cached := await not_modified(request, response):
+        return cached
+
+    def run(conn: sqlite3.Connection):
+        # Answered from the running aggregates kept by ingest, O(devices)
+        rows = conn.execute("SELECT * FROM device_stats ORDER BY device_id").fetchall()
+
+        stats = {
+            "total_measurements": sum(row["message_count"] for row in rows),
+            "total_devices": len(rows),
+            "first_measurement": min((row["first_seen"] for row in rows), default=None),
+            "last_measurement": max((row["last_seen"] for row in rows), default=None),
+        }
 
-    conn.close()
+        device_stats = []
+        for row in rows:
+            fields = {f: field_summary(row, f) for f in STAT_FIELDS}
+            device_stats.append(
+                {
+                    "device_id": row["device_id"],
+                    "measurement_count": row["message_count"],
+                    "first_seen": row["first_seen"],
+                    "last_seen": row["last_seen"],
+                    "avg_temp_dht22": fields["dht22_temperature_c"]["mean"],
+                    "avg_temp_bmp280": fields["bmp280_temperature_c"]["mean"],
+                    "avg_humidity": fields["dht22_humidity_percent"]["mean"],
+                    "avg_pressure": fields["bmp280_pressure_pa"]["mean"],
+                    "fields": fields,
+                }
+            )
+        return stats, device_stats
+
+    stats, device_stats = await db.run(run)
 
     return {"overall": stats, "devices": device_stats}
 
 
+@app.get("/api/export")
+async def export_measurements(
+    format: str = Query("csv", pattern="^(csv|arrow|parquet)$"),
+    device_id: List[str] = Query([]),
+    start: Optional[int] = Query(None, description="Unix seconds, inclusive"),
+    end: Optional[int] = Query(None, description="Unix seconds, exclusive"),
+):
+    """
+    Stream raw measurements as CSV, Arrow IPC stream or Parquet. Rows are
+    read in batches from one snapshot and written out as they arrive, so
+    any range can be exported without buffering it in memory.
+    """
+    try:
+        writer = make_writer(format)
+    except RuntimeError as e:
+        raise HTTPException(status_code=400, detail=str(e))
+
+    query, params = export_query(device_id, start, end)
+    loop = asyncio.get_running_loop()
+
+    async def chunks():
+        rows = db.stream(query, params, timeout=EXPORT_TIMEOUT, batch_size=EXPORT_BATCH_SIZE)
+        try:
+            columns = await rows.__anext__()
+            yield writer.begin(columns)
+            async for batch in rows:
+                # Encoding a batch is CPU work, keep it off the event loop.
+                yield await loop.run_in_executor(None, writer.write, batch)
+            yield writer.end()
+        except QueryTimeout as e:
+            # Headers are already sent; a truncated body is all we can signal.
+            logging.warning(f"Export timed out: {e}")
+        finally:
+            await rows.aclose()
+
+    filename = f"measurements-{int(time.time())}.{format}"
+    return StreamingResponse(
+        chunks(),
+        media_type=MEDIA_TYPES[format],
+        headers={"Content-Disposition": f'attachment; filename="{filename}"'},
+    )
+
+
+def require_admin(request: Request) -> None:
+    if not ADMIN_TOKEN:
+        raise HTTPException(status_code=403, detail="Admin endpoints are disabled, set ADMIN_TOKEN")
+    scheme, _, token = request.headers.get("authorization", "").partition(" ")
+    if scheme.lower() != "bearer" or not hmac.compare_digest(token.encode(), ADMIN_TOKEN.encode()):
+        raise HTTPException(status_code=401, detail="Invalid admin token")
+
+
+@app.post("/api/admin/backup", status_code=202)
+async def start_backup(request: Request):
+    """Start an online snapshot of the database in the background."""
+    require_admin(request)
+    name = snapshotter.start()
+    if name is None:
+        raise HTTPException(status_code=409, detail="A backup is already running")
+    return {"status": "started", "name": name}
+
+
+@app.get("/api/admin/backup")
+async def backup_status(request: Request):
+    """Progress of the running snapshot, the last result and the snapshots on disk."""
+    require_admin(request)
+    return snapshotter.status()
+
+
 @app.get("/api/query/test")
 async def test_query_endpoint():
     """Test if query endpoint is accessible."""
     return {"status": "Query endpoint is working", "method": "GET"}
 
 
+def summarize_plan(rows) -> Dict[str, Any]:
+    """Condense EXPLAIN QUERY PLAN output into what a console user needs."""
+    steps = [row["detail"] for row in rows]
+    return {
+        "steps": steps,
+        "full_scans": [
+            d for d in steps if d.startswith("SCAN ") and not d.startswith("SCAN CONSTANT")
+        ],
+        "temp_btree": any("TEMP B-TREE" in d for d in steps),
+    }
+
+
 @app.post("/api/query")
 async def execute_query(request: Request):
-    """Execute a custom SQL query (read-only)."""
+    """
+    Execute a custom SQL query (read-only) and stream the result as NDJSON:
+    a header line with the column names and query plan, one JSON array per
+    row, and a closing line with the row count and whether a time, row or
+    size limit cut the result short.
+    """
     try:
         body = await request.json()
         query = body.get("query", "").strip()
@@ -349,18 +955,20 @@ async def execute_query(request: Request):
                     status_code=403, detail=f"Query contains forbidden keyword: {keyword}"
                 )
 
-        conn = get_db_connection()
-        cursor = conn.cursor()
-
-        cursor.execute(query)
-        rows = cursor.fetchall()
-        conn.close()
-
-        # Convert rows to list of dicts
-        results = [dict(row) for row in rows]
-
-        return {"results": results, "count": len(results)}
-
+        if query_slots.locked():
+            raise HTTPException(status_code=429, detail="Too many queries running, retry shortly")
+        # acquire() does not suspend while a slot is free, so no other request
+        # can take it between the check and here.
+        await query_slots.acquire()
+        try:
+            # Also surfaces syntax errors before any output is sent.
+            plan = summarize_plan(await db.fetchall(f"EXPLAIN QUERY PLAN {query}"))
+        except BaseException:
+            query_slots.release()
+            raise
+
+    except HTTPException:
+        raise
     except sqlite3.Error as e:
         logging.error(f"Query execution error: {e}")
         raise HTTPException(status_code=400, detail=f"Database error: {str(e)}")
@@ -368,6 +976,63 @@ async def execute_query(request: Request):
         logging.error(f"Query error: {e}")
         raise HTTPException(status_code=500, detail=str(e))
 
+    async def lines():
+        try:
+            started = time.monotonic()
+            count = 0
+            size = 0
+            reason = None
+            error = None
+
+            rows = db.stream(query, timeout=QUERY_TIMEOUT)
+            try:
+                columns = await rows.__anext__()
+                yield json.dumps({"columns": columns, "plan": plan}) + "\n"
+
+                async for batch in rows:
+                    if count + len(batch) > QUERY_MAX_ROWS:
+                        batch = batch[: QUERY_MAX_ROWS - count]
+                        reason = "row_limit"
+
+                    chunk = "".join(json.dumps(row, default=str) + "\n" for row in batch).encode()
+                    count += len(batch)
+                    size += len(chunk)
+                    yield chunk
+
+                    if reason is None and size > QUERY_MAX_BYTES:
+                        reason = "size_limit"
+                    if reason is not None:
+                        break
+            except StopAsyncIteration:
+                pass
+            except QueryTimeout as e:
+                logging.warning(f"Query timed out: {e}")
+                reason, error = "timeout", str(e)
+            except sqlite3.Error as e:
+                logging.error(f"Query execution error: {e}")
+                reason, error = "error", str(e)
+            finally:
+                await rows.aclose()
+
+            yield json.dumps(
+                {
+                    "done": True,
+                    "count": count,
+                    "truncated": reason is not None,
+                    "reason": reason,
+                    "error": error,
+                    "elapsed_ms": round((time.monotonic() - started) * 1000, 1),
+                }
+            ) + "\n"
+        finally:
+            release_slot()
+
+    body = lines()
+    # Gives the slot back exactly once: when lines() ends, or when the
+    # response is dropped before lines() ever ran (its finally never runs then).
+    release_slot = weakref.finalize(body, query_slots.release)
+    return StreamingResponse(body, media_type="application/x-ndjson")
+
 
 if __name__ == "__main__":
     import uvicorn